@@ -0,0 +1,73 @@
+#include <charconv>
+#include "appendbuffer.h"
+
+void AppendBuffer::clear() {
+    bytes.clear();
+}
+
+void AppendBuffer::truncate(size_t size) {
+    if (size < bytes.size()) {
+        bytes.resize(size);
+    }
+}
+
+const char* AppendBuffer::data() const {
+    return bytes.data();
+}
+
+size_t AppendBuffer::size() const {
+    return bytes.size();
+}
+
+bool AppendBuffer::empty() const {
+    return bytes.empty();
+}
+
+std::string_view AppendBuffer::view() const {
+    return bytes;
+}
+
+void AppendBuffer::append(char c) {
+    bytes += c;
+}
+
+void AppendBuffer::append(std::string_view text) {
+    bytes += text;
+}
+
+void AppendBuffer::fill(char c, size_t count) {
+    bytes.append(count, c);
+}
+
+void AppendBuffer::appendNumber(uint64_t n, int width) {
+    char digits[20];
+    char* end = std::to_chars(digits, digits + sizeof(digits), n).ptr;
+    int length = end - digits;
+    if (width > length) {
+        fill(' ', width - length);
+    }
+    bytes.append(digits, length);
+}
+
+void AppendBuffer::appendCsi(int n, char final) {
+    bytes += "\x1b[";
+    appendNumber(n);
+    bytes += final;
+}
+
+void AppendBuffer::appendCursorPosition(int row, int col) {
+    bytes += "\x1b[";
+    appendNumber(row + 1);
+    bytes += ';';
+    appendNumber(col + 1);
+    bytes += 'H';
+}
+
+int decimalWidth(uint64_t n) {
+    int width = 1;
+    while (n >= 10) {
+        n /= 10;
+        ++width;
+    }
+    return width;
+}
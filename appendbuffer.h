@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Bytes built up for the terminal. clear() keeps the capacity, so once a
+// buffer has grown to the size of a frame, building the next one doesn't
+// allocate. The formatters write straight into it rather than through a
+// temporary string.
+class AppendBuffer {
+public:
+    void clear();
+    // Drop everything after the first `size` bytes
+    void truncate(size_t size);
+
+    const char* data() const;
+    size_t size() const;
+    bool empty() const;
+    std::string_view view() const;
+
+    void append(char c);
+    void append(std::string_view text);
+    // `count` copies of `c`
+    void fill(char c, size_t count);
+
+    // Decimal, right aligned in `width` columns
+    void appendNumber(uint64_t n, int width = 0);
+
+    // CSI n final, e.g. 3 'S'
+    void appendCsi(int n, char final);
+    // Cursor to 0 based row, col
+    void appendCursorPosition(int row, int col);
+
+private:
+    std::string bytes;
+};
+
+// Digits in the decimal form of `n`
+int decimalWidth(uint64_t n);
@@ -0,0 +1,269 @@
+// Microbenchmark for the kernels in simd.h against the code they replaced.
+// Prints bytes per cycle for every SIMD level the CPU supports.
+#include <algorithm>
+#include <cctype>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <x86intrin.h>
+#include "../simd.h"
+
+static const int TAB_STOP = 8;
+
+// parseLine before the kernels
+static std::string legacyParseLine(const std::string& line) {
+    int tabs = 0;
+    std::string ret = "";
+    for (const char ch : line) {
+        if (ch == '\t') {
+            ++tabs;
+        }
+        else {
+            std::string tab = std::string(TAB_STOP, ' ');
+            for (int i = 0; i < tabs; ++i) {
+                ret += tab;
+            }
+            tabs = 0;
+            ret += ch;
+        }
+    }
+    return ret;
+}
+
+// Editor::rowCxToRx before the kernels
+static int legacyCxToRx(const std::string& row, int cx) {
+    int rx = 0;
+    for (int i = 0; i < cx; i++) {
+        if (row[i] == '\t') {
+            rx += (TAB_STOP - 1);
+        }
+        rx++;
+    }
+    return rx;
+}
+
+// Words in a row the way wordMotion found them before the kernels, one
+// character class at a time
+static size_t legacyCountWords(const std::string& row) {
+    auto isKeywordChar = [](char c) {
+        return std::isalnum((unsigned char)c) || c == '_';
+    };
+    size_t words = 0;
+    size_t cx = 0;
+    while (cx < row.size()) {
+        if (std::isspace((unsigned char)row[cx])) {
+            ++cx;
+            continue;
+        }
+        bool currIsKeyword = isKeywordChar(row[cx]);
+        while (cx < row.size() && !std::isspace((unsigned char)row[cx]) && isKeywordChar(row[cx]) == currIsKeyword) {
+            ++cx;
+        }
+        ++words;
+    }
+    return words;
+}
+
+// The indexer's newline scan before the kernels
+static void legacyFindNewlines(const char* data, size_t len, std::vector<uint32_t>& out) {
+    size_t pos = 0;
+    while (pos < len) {
+        const char* found = static_cast<const char*>(memchr(data + pos, '\n', len - pos));
+        if (!found) {
+            break;
+        }
+        pos = found - data;
+        out.push_back(pos);
+        ++pos;
+    }
+}
+
+static std::vector<std::string> makefileLines() {
+    std::vector<std::string> lines;
+    for (int i = 0; i < 20000; ++i) {
+        lines.push_back("obj/module" + std::to_string(i) + ".o: src/module" + std::to_string(i) + ".c include/common.h");
+        lines.push_back("\t$(CC) $(CFLAGS) $(CPPFLAGS) -c $< -o $@");
+        lines.push_back("\t@echo \"  CC\t$@\"");
+        lines.push_back("");
+    }
+    return lines;
+}
+
+static std::vector<std::string> tsvLines() {
+    std::vector<std::string> lines;
+    for (int i = 0; i < 20000; ++i) {
+        std::string line;
+        for (int field = 0; field < 24; ++field) {
+            line += std::to_string(i * 31 + field * 7 % 1000);
+            line += field % 3 ? "\tab" : "\t";
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+static size_t totalBytes(const std::vector<std::string>& lines) {
+    size_t bytes = 0;
+    for (const std::string& line : lines) {
+        bytes += line.size();
+    }
+    return bytes;
+}
+
+// Best of a few runs, in bytes per cycle
+template <typename F>
+static double measure(size_t bytes, F&& f) {
+    unsigned long long best = ~0ull;
+    for (int run = 0; run < 7; ++run) {
+        unsigned long long start = __rdtsc();
+        f();
+        best = std::min(best, __rdtsc() - start);
+    }
+    return static_cast<double>(bytes) / best;
+}
+
+static volatile size_t sink;
+
+static void benchLines(const char* name, const std::vector<std::string>& lines, const std::vector<SimdLevel>& levels) {
+    size_t bytes = totalBytes(lines);
+    printf("%s (%zu lines, %zu bytes)\n", name, lines.size(), bytes);
+
+    double legacy = measure(bytes, [&] {
+        for (const std::string& line : lines) {
+            sink = legacyParseLine(line).size();
+        }
+    });
+    printf("  %-12s %-8s %8.3f bytes/cycle\n", "expandTabs", "legacy", legacy);
+    for (SimdLevel level : levels) {
+        setSimdLevel(level);
+        double rate = measure(bytes, [&] {
+            for (const std::string& line : lines) {
+                std::string out;
+                expandTabs(line.data(), line.size(), TAB_STOP, out);
+                sink = out.size();
+            }
+        });
+        printf("  %-12s %-8s %8.3f bytes/cycle  %5.1fx\n", "expandTabs", simdLevelName(level), rate, rate / legacy);
+    }
+
+    legacy = measure(bytes, [&] {
+        for (const std::string& line : lines) {
+            sink = legacyCxToRx(line, line.size());
+        }
+    });
+    printf("  %-12s %-8s %8.3f bytes/cycle\n", "cxToRx", "legacy", legacy);
+    for (SimdLevel level : levels) {
+        setSimdLevel(level);
+        double rate = measure(bytes, [&] {
+            for (const std::string& line : lines) {
+                sink = cxToRx(line.data(), line.size(), line.size(), TAB_STOP);
+            }
+        });
+        printf("  %-12s %-8s %8.3f bytes/cycle  %5.1fx\n", "cxToRx", simdLevelName(level), rate, rate / legacy);
+    }
+
+    legacy = measure(bytes, [&] {
+        for (const std::string& line : lines) {
+            sink = legacyCountWords(line);
+        }
+    });
+    printf("  %-12s %-8s %8.3f bytes/cycle\n", "words", "legacy", legacy);
+    std::vector<uint64_t> starts;
+    std::vector<uint64_t> ends;
+    for (SimdLevel level : levels) {
+        setSimdLevel(level);
+        double rate = measure(bytes, [&] {
+            for (const std::string& line : lines) {
+                wordBoundaries(line.data(), line.size(), starts, ends);
+                size_t words = 0;
+                for (uint64_t word : starts) {
+                    words += __builtin_popcountll(word);
+                }
+                sink = words;
+            }
+        });
+        printf("  %-12s %-8s %8.3f bytes/cycle  %5.1fx\n", "words", simdLevelName(level), rate, rate / legacy);
+    }
+}
+
+static void benchNewlines(const char* name, const std::vector<std::string>& lines, const std::vector<SimdLevel>& levels) {
+    std::string text;
+    for (int copy = 0; copy < 8; ++copy) {
+        for (const std::string& line : lines) {
+            text += line;
+            text += '\n';
+        }
+    }
+    printf("%s newlines (%zu bytes)\n", name, text.size());
+
+    std::vector<uint32_t> found;
+    found.reserve(text.size() / 8);
+    double legacy = measure(text.size(), [&] {
+        found.clear();
+        legacyFindNewlines(text.data(), text.size(), found);
+    });
+    printf("  %-12s %-8s %8.3f bytes/cycle\n", "findNewlines", "legacy", legacy);
+    for (SimdLevel level : levels) {
+        setSimdLevel(level);
+        double rate = measure(text.size(), [&] {
+            found.clear();
+            findNewlines(text.data(), text.size(), found);
+        });
+        printf("  %-12s %-8s %8.3f bytes/cycle  %5.1fx\n", "findNewlines", simdLevelName(level), rate, rate / legacy);
+    }
+}
+
+// A search for text that isn't there, so every byte is looked at: the per
+// line std::string::find search would do against one findSubstring over the
+// text, as Buffer::find does over each piece
+static void benchSearch(const char* name, const std::vector<std::string>& lines, const std::vector<SimdLevel>& levels) {
+    const std::string needle = "module_not_there";
+    std::string text;
+    for (int copy = 0; copy < 8; ++copy) {
+        for (const std::string& line : lines) {
+            text += line;
+            text += '\n';
+        }
+    }
+    printf("%s search (%zu bytes)\n", name, text.size());
+
+    std::vector<std::string> copies;
+    for (int copy = 0; copy < 8; ++copy) {
+        copies.insert(copies.end(), lines.begin(), lines.end());
+    }
+    double legacy = measure(text.size(), [&] {
+        size_t found = 0;
+        for (const std::string& line : copies) {
+            found += line.find(needle) != std::string::npos;
+        }
+        sink = found;
+    });
+    printf("  %-12s %-8s %8.3f bytes/cycle\n", "search", "legacy", legacy);
+    for (SimdLevel level : levels) {
+        setSimdLevel(level);
+        double rate = measure(text.size(), [&] {
+            sink = findSubstring(text.data(), text.size(), needle);
+        });
+        printf("  %-12s %-8s %8.3f bytes/cycle  %5.1fx\n", "search", simdLevelName(level), rate, rate / legacy);
+    }
+}
+
+int main() {
+    std::vector<SimdLevel> levels;
+    for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::SSE2, SimdLevel::AVX2}) {
+        if (level <= detectSimdLevel()) {
+            levels.push_back(level);
+        }
+    }
+
+    std::vector<std::string> makefile = makefileLines();
+    std::vector<std::string> tsv = tsvLines();
+    benchLines("Makefile", makefile, levels);
+    benchLines("TSV", tsv, levels);
+    benchNewlines("Makefile", makefile, levels);
+    benchNewlines("TSV", tsv, levels);
+    benchSearch("Makefile", makefile, levels);
+    benchSearch("TSV", tsv, levels);
+    return 0;
+}
@@ -0,0 +1,167 @@
+// Replays recorded key sessions from bench/sessions against the editor on a
+// headless terminal. Files to edit are generated. Prints total time, per key
+// latency, bytes sent to the terminal and heap allocations for each session,
+// then checks that redrawing a screen that's already been drawn allocates
+// nothing at all.
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "../editor.h"
+#include "../headless.h"
+#include "../perf.h"
+
+static const int ROWS = 50;
+static const int COLS = 200;
+
+static std::string readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        fprintf(stderr, "Can't read %s\n", path.c_str());
+        exit(1);
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+static void writeFile(const std::string& path, const std::string& text) {
+    std::ofstream file(path, std::ios::binary);
+    file << text;
+}
+
+// Source-like lines with indentation, brackets and the odd tab
+static std::string generateCode(size_t lines) {
+    std::minstd_rand rng(1);
+    std::string text;
+    for (size_t i = 0; i < lines; ++i) {
+        int depth = rng() % 4;
+        text.append(depth * 4, ' ');
+        switch (rng() % 4) {
+            case 0: text += "if (count > limit) {"; break;
+            case 1: text += "total += values[index] * scale;"; break;
+            case 2: text += "}"; break;
+            case 3: text += "\tresult = compute(first, second); // note"; break;
+        }
+        text += '\n';
+    }
+    return text;
+}
+
+// Long tab separated lines, wider than the screen
+static std::string generateWide(size_t lines) {
+    std::minstd_rand rng(2);
+    std::string text;
+    for (size_t i = 0; i < lines; ++i) {
+        for (int field = 0; field < 40; ++field) {
+            text += std::to_string(rng() % 100000);
+            text += '\t';
+        }
+        text += "end\n";
+    }
+    return text;
+}
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+static void replay(const char* name, const std::string& path, const std::string& keys) {
+    HeadlessTerminal terminal(ROWS, COLS, keys);
+    Editor editor(terminal);
+    // Draw a frame for every key rather than pace them, and don't wait on
+    // lone ESCs, since keys arrive whole
+    editor.setCommandHandler("maxfps=100000");
+    editor.setCommandHandler("esctimeout=0");
+    // Leave nothing behind in the temp dir
+    editor.setCommandHandler("noswapfile noundofile");
+    editor.openFile(path);
+    editor.appendIfBufferEmpty();
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t allocationsBefore = allocationCount();
+    while (editor.running()) {
+        editor.processKeyPress();
+    }
+    uint64_t allocations = allocationCount() - allocationsBefore;
+    std::chrono::duration<double, std::milli> total = std::chrono::steady_clock::now() - start;
+
+    std::vector<double> micros;
+    for (auto latency : terminal.latencies) {
+        micros.push_back(std::chrono::duration<double, std::micro>(latency).count());
+    }
+    size_t bytes = terminal.sink.size();
+    double handled = std::max<size_t>(1, micros.size());
+    printf("  %-8s %6zu keys %9.1f ms   p50 %8.1f us   p99 %8.1f us   %9zu bytes  %7.1f bytes/key  %6.1f allocs/key\n",
+        name, micros.size(), total.count(), percentile(micros, 0.5), percentile(micros, 0.99),
+        bytes, bytes / handled, allocations / handled);
+}
+
+// Moves around within the first screen, so every frame is one that's been
+// drawn before. Once warmed up, handling a key and drawing its frame should
+// not touch the heap. Returns false if it does
+static bool steady(const std::string& path) {
+    const size_t WARMUP = 100;
+    // G first, so the whole file is indexed before counting starts rather
+    // than chunks still coming in from the indexer while it runs
+    std::string keys = "Ggg";
+    for (int i = 0; i < 1000; ++i) {
+        keys += "jjlhkk";
+    }
+    HeadlessTerminal terminal(ROWS, COLS, keys);
+    // Keep the terminal's own bookkeeping out of the count
+    terminal.sink.reserve(1 << 20);
+    terminal.latencies.reserve(keys.size() + 1);
+    terminal.bytes.reserve(keys.size() + 1);
+    Editor editor(terminal);
+    editor.setCommandHandler("maxfps=100000");
+    editor.setCommandHandler("noswapfile noundofile");
+    editor.openFile(path);
+    editor.appendIfBufferEmpty();
+
+    uint64_t allocationsBefore = 0;
+    while (editor.running()) {
+        if (terminal.latencies.size() == WARMUP && !allocationsBefore) {
+            allocationsBefore = allocationCount();
+        }
+        editor.processKeyPress();
+    }
+    uint64_t allocations = allocationCount() - allocationsBefore;
+    size_t measured = terminal.latencies.size() - WARMUP;
+    printf("  %-8s %6zu keys %s: %llu allocations after warmup\n",
+        "steady", measured, allocations ? "FAIL" : "ok", (unsigned long long)allocations);
+    return allocations == 0;
+}
+
+int main() {
+    char dir[] = "/tmp/mirt-bench-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string code = std::string(dir) + "/code.txt";
+    std::string wide = std::string(dir) + "/wide.txt";
+    writeFile(code, generateCode(500000));
+    writeFile(wide, generateWide(20000));
+
+    printf("Session replay (%dx%d headless terminal)\n", COLS, ROWS);
+    replay("scroll", code, readFile("bench/sessions/scroll.keys"));
+    replay("edit", code, readFile("bench/sessions/edit.keys"));
+    replay("wide", wide, readFile("bench/sessions/wide.keys"));
+    bool ok = steady(code);
+
+    unlink(code.c_str());
+    unlink(wide.c_str());
+    rmdir(dir);
+    return ok ? 0 : 1;
+}
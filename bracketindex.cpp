@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <cassert>
+#include "bracketindex.h"
+
+BracketIndex::BracketIndex(Buffer& buffer) :
+    buffer{buffer},
+    rng{0x6d697274}
+{
+}
+
+void BracketIndex::reset() {
+    root.reset();
+}
+
+void BracketIndex::lineChanged(size_t line) {
+    if (line >= covered()) {
+        return;
+    }
+    set(root.get(), line, summarize(line));
+}
+
+void BracketIndex::linesInserted(size_t line, size_t count) {
+    if (line > covered() || count == 0) {
+        return;
+    }
+    NodePtr added;
+    for (size_t i = line; i < line + count; ++i) {
+        added = merge(std::move(added), makeNode(summarize(i)));
+    }
+    auto [lhs, rhs] = split(std::move(root), line);
+    root = merge(merge(std::move(lhs), std::move(added)), std::move(rhs));
+}
+
+void BracketIndex::linesRemoved(size_t line, size_t count) {
+    if (line >= covered() || count == 0) {
+        return;
+    }
+    auto [lhs, rest] = split(std::move(root), line);
+    auto [removed, rhs] = split(std::move(rest), count);
+    root = merge(std::move(lhs), std::move(rhs));
+}
+
+std::optional<std::pair<size_t, size_t>> BracketIndex::match(size_t line, size_t col) {
+    buffer.ensureLines(line + 1);
+    if (line >= buffer.lineCount()) {
+        return std::nullopt;
+    }
+    buffer.readLine(line, text);
+    if (col >= text.size() || typeOf(text[col]) == -1) {
+        return std::nullopt;
+    }
+    int type = typeOf(text[col]);
+    bool forward = isOpen(text[col]);
+
+    // Most matches are on the same line
+    size_t depth = 1;
+    size_t found = forward ? scan(text, col + 1, true, type, depth) : scan(text, col, false, type, depth);
+    if (found != std::string::npos) {
+        return std::make_pair(line, found);
+    }
+
+    if (!forward) {
+        cover(line);
+        size_t at = findBackward(root.get(), 0, line, type, depth);
+        if (at == std::string::npos) {
+            return std::nullopt;
+        }
+        buffer.readLine(at, text);
+        found = scan(text, text.size(), false, type, depth);
+        assert(found != std::string::npos);
+        return std::make_pair(at, found);
+    }
+
+    // Summarise further down the file only as far as it takes
+    cover(line + 1);
+    while (true) {
+        size_t left = depth;
+        size_t at = findForward(root.get(), 0, line + 1, type, left);
+        if (at != std::string::npos) {
+            buffer.readLine(at, text);
+            found = scan(text, 0, true, type, left);
+            assert(found != std::string::npos);
+            return std::make_pair(at, found);
+        }
+        if (covered() >= buffer.lineCount() && buffer.fullyIndexed()) {
+            return std::nullopt;
+        }
+        cover(std::max<size_t>(1024, covered() * 2));
+    }
+}
+
+size_t BracketIndex::bytes() const {
+    return covered() * sizeof(Node);
+}
+
+int BracketIndex::typeOf(char c) {
+    switch (c) {
+        case '(':
+        case ')':
+            return 0;
+        case '[':
+        case ']':
+            return 1;
+        case '{':
+        case '}':
+            return 2;
+    }
+    return -1;
+}
+
+bool BracketIndex::isOpen(char c) {
+    return c == '(' || c == '[' || c == '{';
+}
+
+size_t BracketIndex::scan(std::string_view text, size_t from, bool forward, int type, size_t& depth) {
+    if (forward) {
+        for (size_t i = from; i < text.size(); ++i) {
+            if (typeOf(text[i]) != type) {
+                continue;
+            }
+            if (isOpen(text[i])) {
+                ++depth;
+            }
+            else if (--depth == 0) {
+                return i;
+            }
+        }
+    }
+    else {
+        for (size_t i = from; i-- > 0;) {
+            if (typeOf(text[i]) != type) {
+                continue;
+            }
+            if (!isOpen(text[i])) {
+                ++depth;
+            }
+            else if (--depth == 0) {
+                return i;
+            }
+        }
+    }
+    return std::string::npos;
+}
+
+BracketIndex::Summary BracketIndex::summarize(size_t line) {
+    buffer.readLine(line, text);
+    Summary summary{};
+    for (char c : text) {
+        int type = typeOf(c);
+        if (type == -1) {
+            continue;
+        }
+        if (isOpen(c)) {
+            ++summary.open[type];
+        }
+        else if (summary.open[type] > 0) {
+            --summary.open[type];
+        }
+        else {
+            ++summary.close[type];
+        }
+    }
+    return summary;
+}
+
+BracketIndex::Summary BracketIndex::combine(const Summary& lhs, const Summary& rhs) {
+    Summary summary;
+    for (int type = 0; type < TYPES; ++type) {
+        uint32_t matched = std::min(lhs.open[type], rhs.close[type]);
+        summary.close[type] = lhs.close[type] + rhs.close[type] - matched;
+        summary.open[type] = lhs.open[type] - matched + rhs.open[type];
+    }
+    return summary;
+}
+
+size_t BracketIndex::covered() const {
+    return root ? root->count : 0;
+}
+
+void BracketIndex::cover(size_t count) {
+    if (count <= covered()) {
+        return;
+    }
+    buffer.ensureLines(count);
+    count = std::min(count, buffer.lineCount());
+    for (size_t line = covered(); line < count; ++line) {
+        root = merge(std::move(root), makeNode(summarize(line)));
+    }
+}
+
+BracketIndex::NodePtr BracketIndex::makeNode(const Summary& line) {
+    NodePtr node = std::make_unique<Node>();
+    node->line = line;
+    node->priority = rng();
+    update(node.get());
+    return node;
+}
+
+void BracketIndex::update(Node* node) {
+    node->total = node->line;
+    node->count = 1;
+    if (node->left) {
+        node->total = combine(node->left->total, node->total);
+        node->count += node->left->count;
+    }
+    if (node->right) {
+        node->total = combine(node->total, node->right->total);
+        node->count += node->right->count;
+    }
+}
+
+std::pair<BracketIndex::NodePtr, BracketIndex::NodePtr> BracketIndex::split(NodePtr node, size_t count) {
+    if (!node) {
+        return {nullptr, nullptr};
+    }
+    size_t leftCount = node->left ? node->left->count : 0;
+    if (count <= leftCount) {
+        auto [lhs, rhs] = split(std::move(node->left), count);
+        node->left = std::move(rhs);
+        update(node.get());
+        return {std::move(lhs), std::move(node)};
+    }
+    auto [lhs, rhs] = split(std::move(node->right), count - leftCount - 1);
+    node->right = std::move(lhs);
+    update(node.get());
+    return {std::move(node), std::move(rhs)};
+}
+
+BracketIndex::NodePtr BracketIndex::merge(NodePtr lhs, NodePtr rhs) {
+    if (!lhs) {
+        return rhs;
+    }
+    if (!rhs) {
+        return lhs;
+    }
+    if (lhs->priority > rhs->priority) {
+        lhs->right = merge(std::move(lhs->right), std::move(rhs));
+        update(lhs.get());
+        return lhs;
+    }
+    rhs->left = merge(std::move(lhs), std::move(rhs->left));
+    update(rhs.get());
+    return rhs;
+}
+
+void BracketIndex::set(Node* node, size_t line, const Summary& summary) {
+    size_t leftCount = node->left ? node->left->count : 0;
+    if (line < leftCount) {
+        set(node->left.get(), line, summary);
+    }
+    else if (line > leftCount) {
+        set(node->right.get(), line - leftCount - 1, summary);
+    }
+    else {
+        node->line = summary;
+    }
+    update(node);
+}
+
+size_t BracketIndex::findForward(const Node* node, size_t lo, size_t from, int type, size_t& depth) const {
+    if (!node || lo + node->count <= from) {
+        return std::string::npos;
+    }
+    if (lo >= from && node->total.close[type] < depth) {
+        // Every close in here is matched before the depth runs out
+        depth = depth - node->total.close[type] + node->total.open[type];
+        return std::string::npos;
+    }
+    size_t at = lo + (node->left ? node->left->count : 0);
+    size_t found = findForward(node->left.get(), lo, from, type, depth);
+    if (found != std::string::npos) {
+        return found;
+    }
+    if (at >= from) {
+        if (node->line.close[type] >= depth) {
+            return at;
+        }
+        depth = depth - node->line.close[type] + node->line.open[type];
+    }
+    return findForward(node->right.get(), at + 1, from, type, depth);
+}
+
+size_t BracketIndex::findBackward(const Node* node, size_t lo, size_t to, int type, size_t& depth) const {
+    if (!node || lo >= to) {
+        return std::string::npos;
+    }
+    if (lo + node->count <= to && node->total.open[type] < depth) {
+        depth = depth - node->total.open[type] + node->total.close[type];
+        return std::string::npos;
+    }
+    size_t at = lo + (node->left ? node->left->count : 0);
+    size_t found = findBackward(node->right.get(), at + 1, to, type, depth);
+    if (found != std::string::npos) {
+        return found;
+    }
+    if (at < to) {
+        if (node->line.open[type] >= depth) {
+            return at;
+        }
+        depth = depth - node->line.open[type] + node->line.close[type];
+    }
+    return findBackward(node->left.get(), lo, to, type, depth);
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "buffer.h"
+
+// Finds the bracket matching another without walking the text in between.
+// Each line is summarised, per bracket type, by the closes in it with no open
+// before them and the opens left unclosed. A treap of lines, ordered by line
+// number, combines the summaries, so the line holding a match is found in
+// O(log n) and only that line and the bracket's own are scanned. Lines go in
+// and come out in O(log n) too, so edits don't cost a rebuild.
+//
+// Summaries cover a prefix of the buffer, grown as searches need it, and are
+// kept in step by the editor telling the index about each edit.
+class BracketIndex {
+public:
+    static constexpr int TYPES = 3;
+
+    explicit BracketIndex(Buffer& buffer);
+
+    // Forget every line, e.g. after opening a file
+    void reset();
+
+    // `line` was edited in place
+    void lineChanged(size_t line);
+
+    // `count` lines were inserted before `line`, or removed from it
+    void linesInserted(size_t line, size_t count);
+    void linesRemoved(size_t line, size_t count);
+
+    // Position of the bracket matching the one at line, col, if that is a
+    // bracket and it has a match
+    std::optional<std::pair<size_t, size_t>> match(size_t line, size_t col);
+
+    // Heap bytes held by the summaries
+    size_t bytes() const;
+
+    // Bracket type of `c`, or -1 if it isn't one
+    static int typeOf(char c);
+    static bool isOpen(char c);
+
+    // Scan text[from, end) forwards, or text[0, from) backwards, counting
+    // brackets of `type` into `depth`, the number still unmatched. Returns
+    // where depth reaches 0, or npos with depth left as it ends up
+    static size_t scan(std::string_view text, size_t from, bool forward, int type, size_t& depth);
+
+private:
+    struct Summary {
+        uint32_t close[TYPES];
+        uint32_t open[TYPES];
+    };
+
+    struct Node;
+    using NodePtr = std::unique_ptr<Node>;
+
+    // One line
+    struct Node {
+        Summary line;
+        uint32_t priority;
+        // Over the subtree rooted here, its lines in order
+        Summary total;
+        size_t count;
+        NodePtr left;
+        NodePtr right;
+    };
+
+    Buffer& buffer;
+    // Lines [0, covered())
+    NodePtr root;
+    std::minstd_rand rng;
+    std::string text;
+
+    Summary summarize(size_t line);
+    static Summary combine(const Summary& lhs, const Summary& rhs);
+
+    // Lines summarised so far
+    size_t covered() const;
+    // Summarise lines up to `count`, or as many as the buffer has
+    void cover(size_t count);
+
+    NodePtr makeNode(const Summary& line);
+    static void update(Node* node);
+    // The first `count` lines of the subtree, and the rest
+    static std::pair<NodePtr, NodePtr> split(NodePtr node, size_t count);
+    static NodePtr merge(NodePtr lhs, NodePtr rhs);
+    // Give line `line` of the subtree `summary`
+    static void set(Node* node, size_t line, const Summary& summary);
+
+    // First line from `from` on where `depth` unmatched opens of `type` are
+    // all closed, and the depth left going into it. `node` starts at line `lo`
+    size_t findForward(const Node* node, size_t lo, size_t from, int type, size_t& depth) const;
+    // Last line before `to` where `depth` unmatched closes are all opened
+    size_t findBackward(const Node* node, size_t lo, size_t to, int type, size_t& depth) const;
+};
@@ -0,0 +1,795 @@
+#include <algorithm>
+#include <cassert>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "buffer.h"
+#include "simd.h"
+
+const char* Buffer::Storage::at(Source source, size_t offset) const {
+    if (source == Source::ORIGINAL) {
+        return original.get() + offset;
+    }
+    return add[offset / ADD_BLOCK].get() + offset % ADD_BLOCK;
+}
+
+// Source of Storage::id
+static uint64_t storageIds = 0;
+
+Buffer::Buffer() :
+    storage{std::make_shared<Storage>()},
+    addSize{0},
+    nextChunk{0},
+    originalIndexed{0},
+    edits{0},
+    rng{0x6d697274}
+{
+    storage->id = ++storageIds;
+}
+
+Buffer::~Buffer() {
+    reset();
+}
+
+void Buffer::reset() {
+    // Workers read the original text, so stop them before it goes
+    indexer.reset();
+    nextChunk = 0;
+    root.reset();
+    storage = std::make_shared<Storage>();
+    storage->id = ++storageIds;
+    addSize = 0;
+    for (NewlineTable& positions : newlines) {
+        positions.clear();
+    }
+    originalIndexed = 0;
+    ++edits;
+}
+
+bool Buffer::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return false;
+    }
+
+    reset();
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            size_t size = st.st_size;
+            storage->original = std::shared_ptr<const char>(
+                static_cast<const char*>(addr),
+                [size](const char* mapped) { munmap(const_cast<char*>(mapped), size); }
+            );
+            storage->originalSize = size;
+        }
+    }
+    if (!storage->original) {
+        // Pipes and the like can't be mapped; read them in
+        auto text = std::make_shared<std::string>();
+        char chunk[1 << 16];
+        ssize_t nread;
+        while ((nread = read(fd, chunk, sizeof(chunk))) > 0) {
+            text->append(chunk, nread);
+        }
+        if (nread == -1) {
+            int err = errno;
+            close(fd);
+            reset();
+            errno = err;
+            return false;
+        }
+        storage->original = std::shared_ptr<const char>(text, text->data());
+        storage->originalSize = text->size();
+    }
+    close(fd);
+    indexer = std::make_unique<LineIndexer>(storage->original.get(), storage->originalSize);
+    return true;
+}
+
+size_t Buffer::lineCount() const {
+    return root ? root->newlines : 0;
+}
+
+bool Buffer::fullyIndexed() const {
+    return originalIndexed == storage->originalSize;
+}
+
+bool Buffer::empty() const {
+    return size() == 0 && fullyIndexed();
+}
+
+void Buffer::ensureLines(size_t lines) {
+    while (lineCount() < lines && !fullyIndexed()) {
+        indexChunk();
+    }
+}
+
+void Buffer::indexAll() {
+    while (!fullyIndexed()) {
+        indexChunk();
+    }
+}
+
+void Buffer::collectIndexed(size_t maxChunks) {
+    while (maxChunks-- && indexReady()) {
+        indexChunk();
+    }
+}
+
+bool Buffer::indexReady() const {
+    return !fullyIndexed() && indexer->ready(nextChunk);
+}
+
+int Buffer::indexProgress() const {
+    if (!indexer || indexer->chunkCount() == 0) {
+        return 100;
+    }
+    return indexer->chunksScanned() * 100 / indexer->chunkCount();
+}
+
+void Buffer::indexChunk() {
+    size_t chunkStart = nextChunk * LineIndexer::CHUNK_SIZE;
+    std::vector<uint32_t> found = indexer->take(nextChunk);
+    bool last = ++nextChunk == indexer->chunkCount();
+
+    // Take whole lines only. Bytes after the chunk's last newline wait for
+    // the next one
+    size_t start = originalIndexed;
+    size_t pieceEnd = found.empty() ? start : chunkStart + found.back() + 1;
+    size_t lines = found.size();
+    newlinesOf(Source::ORIGINAL).append(chunkStart, std::move(found));
+    if (last) {
+        pieceEnd = storage->originalSize;
+    }
+    if (pieceEnd == start) {
+        return;
+    }
+    originalIndexed = pieceEnd;
+
+    size_t length = pieceEnd - start;
+    if (!extendLast(root, Source::ORIGINAL, start, length, lines)) {
+        root = merge(std::move(root), makeNode({Source::ORIGINAL, start, length, lines}));
+    }
+    if (fullyIndexed() && storage->original.get()[pieceEnd - 1] != '\n') {
+        // Terminate the last line like every other
+        insertAt(size(), "\n");
+    }
+}
+
+size_t Buffer::lineLength(size_t line) const {
+    assert(line < lineCount());
+    return lineStart(line + 1) - lineStart(line) - 1;
+}
+
+std::string Buffer::line(size_t line) const {
+    std::string ret;
+    readLine(line, ret);
+    return ret;
+}
+
+void Buffer::readLine(size_t line, std::string& out) const {
+    assert(line < lineCount());
+    size_t start = lineStart(line);
+    size_t end = lineStart(line + 1) - 1;
+    out.clear();
+    out.reserve(end - start);
+    copyRange(root.get(), start, end - start, out);
+}
+
+Buffer::Spans Buffer::spans() const {
+    return Spans(root.get(), storage.get());
+}
+
+Buffer::Snapshot Buffer::snapshot() const {
+    Snapshot snapshot;
+    snapshot.root = root;
+    snapshot.storage = storage;
+    return snapshot;
+}
+
+size_t Buffer::Snapshot::size() const {
+    return root ? root->length : 0;
+}
+
+size_t Buffer::Snapshot::newlines() const {
+    return root ? root->newlines : 0;
+}
+
+size_t Buffer::Snapshot::bytes() const {
+    // make_shared puts a node and its counts in one allocation
+    struct Counted {
+        long counts[2];
+        Node node;
+    };
+    size_t bytes = 0;
+    std::vector<const Node*> stack;
+    if (root) {
+        stack.push_back(root.get());
+    }
+    while (!stack.empty()) {
+        const Node* node = stack.back();
+        stack.pop_back();
+        bytes += sizeof(Counted);
+        for (const Node* child : {node->left.get(), node->right.get()}) {
+            if (child) {
+                stack.push_back(child);
+            }
+        }
+    }
+    return bytes;
+}
+
+uint64_t Buffer::Snapshot::hash() const {
+    // 64 bit FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    Spans spans = this->spans();
+    std::string_view span;
+    while (spans.next(span)) {
+        for (unsigned char c : span) {
+            hash = (hash ^ c) * 0x100000001b3;
+        }
+    }
+    return hash;
+}
+
+Buffer::Spans Buffer::Snapshot::spans() const {
+    return Spans(root.get(), storage.get());
+}
+
+Buffer::Spans::Spans(const Node* root, const Storage* storage) : storage{storage} {
+    pushLeft(root);
+}
+
+void Buffer::Spans::pushLeft(const Node* node) {
+    for (; node; node = node->left.get()) {
+        stack.push_back(node);
+    }
+}
+
+bool Buffer::Spans::next(std::string_view& span) {
+    if (stack.empty()) {
+        return false;
+    }
+    const Node* node = stack.back();
+    stack.pop_back();
+    pushLeft(node->right.get());
+    const Piece& piece = node->piece;
+    span = std::string_view(storage->at(piece.source, piece.start), piece.length);
+    return true;
+}
+
+void Buffer::insert(size_t line, size_t col, std::string_view text) {
+    assert(text.find('\n') == std::string_view::npos);
+    insertAt(offsetOf(line, col), text);
+}
+
+void Buffer::insertText(size_t line, size_t col, std::string_view text) {
+    if (line == lineCount()) {
+        indexAll();
+    }
+    insertAt(positionOf(line, col), text);
+}
+
+void Buffer::erase(size_t line, size_t col, size_t len) {
+    assert(col + len <= lineLength(line));
+    eraseAt(offsetOf(line, col), len);
+}
+
+Buffer::Snapshot Buffer::slice(size_t line1, size_t col1, size_t line2, size_t col2) {
+    size_t start = positionOf(line1, col1);
+    size_t end = positionOf(line2, col2);
+    assert(start <= end);
+    // Splitting a copy of the root clones only the nodes along the cuts
+    NodePtr shared = root;
+    auto [lhs, rest] = split(std::move(shared), start);
+    auto [middle, rhs] = split(std::move(rest), end - start);
+    Snapshot snapshot;
+    snapshot.root = std::move(middle);
+    snapshot.storage = storage;
+    return snapshot;
+}
+
+Buffer::Snapshot Buffer::cut(size_t line1, size_t col1, size_t line2, size_t col2) {
+    size_t start = positionOf(line1, col1);
+    size_t end = positionOf(line2, col2);
+    assert(start <= end);
+    Snapshot snapshot;
+    snapshot.storage = storage;
+    if (start == end) {
+        return snapshot;
+    }
+    ++edits;
+    auto [lhs, rest] = split(std::move(root), start);
+    auto [middle, rhs] = split(std::move(rest), end - start);
+    root = merge(std::move(lhs), std::move(rhs));
+    snapshot.root = std::move(middle);
+    return snapshot;
+}
+
+std::pair<size_t, size_t> Buffer::paste(size_t line, size_t col, const Snapshot& text) {
+    if (line == lineCount()) {
+        // The end of the file is past whatever hasn't been indexed yet
+        indexAll();
+    }
+    if (!text.root) {
+        return {line, col};
+    }
+    size_t pos = positionOf(line, col);
+    size_t endLine = line + text.newlines();
+    if (text.storage->id != storage->id) {
+        // From another file, whose text this buffer can't point into
+        std::string copy;
+        copy.reserve(text.size());
+        Spans spans = text.spans();
+        std::string_view span;
+        while (spans.next(span)) {
+            copy += span;
+        }
+        insertAt(pos, copy);
+    }
+    else {
+        ++edits;
+        auto [lhs, rhs] = split(std::move(root), pos);
+        root = merge(merge(std::move(lhs), text.root), std::move(rhs));
+    }
+    if (endLine == line) {
+        return {line, col + text.size()};
+    }
+    return {endLine, pos + text.size() - lineStart(endLine)};
+}
+
+void Buffer::insertLine(size_t line, std::string_view text) {
+    assert(line <= lineCount());
+    if (line == lineCount()) {
+        // The end of the file is past whatever hasn't been indexed yet
+        indexAll();
+    }
+    std::string withNewline;
+    withNewline.reserve(text.size() + 1);
+    withNewline += text;
+    withNewline += '\n';
+    insertAt(lineStart(line), withNewline);
+}
+
+void Buffer::splitLine(size_t line, size_t col) {
+    insertAt(offsetOf(line, col), "\n");
+}
+
+void Buffer::joinLines(size_t line) {
+    assert(line + 1 < lineCount());
+    // Drop the newline ending `line`
+    eraseAt(lineStart(line + 1) - 1, 1);
+}
+
+size_t Buffer::appendAdd(std::string_view text) {
+    size_t used = addSize % ADD_BLOCK;
+    if (used != 0 && used + text.size() > ADD_BLOCK) {
+        // Doesn't fit in what's left of the current slot
+        addSize += ADD_BLOCK - used;
+    }
+    if (addSize % ADD_BLOCK == 0) {
+        if (storage.use_count() > 1) {
+            // A snapshot is reading the slot list
+            storage = std::make_shared<Storage>(*storage);
+        }
+        size_t slots = std::max<size_t>(1, (text.size() + ADD_BLOCK - 1) / ADD_BLOCK);
+        std::shared_ptr<char[]> block(new char[slots * ADD_BLOCK]);
+        for (size_t i = 0; i < slots; ++i) {
+            storage->add.emplace_back(block, block.get() + i * ADD_BLOCK);
+        }
+    }
+
+    size_t start = addSize;
+    memcpy(storage->add[start / ADD_BLOCK].get() + start % ADD_BLOCK, text.data(), text.size());
+    // Scanned in pieces the offsets fit in 32 bits
+    std::vector<uint32_t> found;
+    for (size_t from = 0; from < text.size(); from += LineIndexer::CHUNK_SIZE) {
+        found.clear();
+        findNewlines(text.data() + from, std::min(LineIndexer::CHUNK_SIZE, text.size() - from), found);
+        newlinesOf(Source::ADD).append(start + from, std::move(found));
+    }
+    addSize += text.size();
+    return start;
+}
+
+size_t Buffer::countNewlines(const Piece& piece, size_t from, size_t to) const {
+    const NewlineTable& positions = newlinesOf(piece.source);
+    return positions.lowerBound(piece.start + to) - positions.lowerBound(piece.start + from);
+}
+
+Buffer::NodePtr Buffer::makeNode(const Piece& piece) {
+    NodePtr node = std::make_shared<Node>();
+    node->piece = piece;
+    node->priority = rng();
+    update(node.get());
+    return node;
+}
+
+void Buffer::own(NodePtr& node) {
+    if (node && node.use_count() > 1) {
+        node = std::make_shared<Node>(*node);
+    }
+}
+
+void Buffer::update(Node* node) {
+    node->length = node->piece.length;
+    node->newlines = node->piece.newlines;
+    if (node->left) {
+        node->length += node->left->length;
+        node->newlines += node->left->newlines;
+    }
+    if (node->right) {
+        node->length += node->right->length;
+        node->newlines += node->right->newlines;
+    }
+}
+
+std::pair<Buffer::NodePtr, Buffer::NodePtr> Buffer::split(NodePtr node, size_t pos) {
+    if (!node) {
+        return {nullptr, nullptr};
+    }
+    own(node);
+    size_t leftLength = node->left ? node->left->length : 0;
+    if (pos <= leftLength) {
+        auto [lhs, rhs] = split(std::move(node->left), pos);
+        node->left = std::move(rhs);
+        update(node.get());
+        return {std::move(lhs), std::move(node)};
+    }
+    if (pos >= leftLength + node->piece.length) {
+        auto [lhs, rhs] = split(std::move(node->right), pos - leftLength - node->piece.length);
+        node->right = std::move(lhs);
+        update(node.get());
+        return {std::move(node), std::move(rhs)};
+    }
+
+    // Cut falls inside this piece
+    size_t cut = pos - leftLength;
+    Piece tail = node->piece;
+    tail.start += cut;
+    tail.length -= cut;
+    tail.newlines = countNewlines(node->piece, cut, node->piece.length);
+    node->piece.length = cut;
+    node->piece.newlines -= tail.newlines;
+    NodePtr rhs = merge(makeNode(tail), std::move(node->right));
+    update(node.get());
+    return {std::move(node), std::move(rhs)};
+}
+
+Buffer::NodePtr Buffer::merge(NodePtr lhs, NodePtr rhs) {
+    if (!lhs) {
+        return rhs;
+    }
+    if (!rhs) {
+        return lhs;
+    }
+    if (lhs->priority > rhs->priority) {
+        own(lhs);
+        lhs->right = merge(std::move(lhs->right), std::move(rhs));
+        update(lhs.get());
+        return lhs;
+    }
+    own(rhs);
+    rhs->left = merge(std::move(lhs), std::move(rhs->left));
+    update(rhs.get());
+    return rhs;
+}
+
+bool Buffer::extendLast(NodePtr& node, Source source, size_t end, size_t length, size_t newlines) {
+    // Look before copying anything
+    const Node* last = node.get();
+    while (last && last->right) {
+        last = last->right.get();
+    }
+    if (!last || last->piece.source != source || last->piece.start + last->piece.length != end) {
+        return false;
+    }
+
+    for (NodePtr* spine = &node; *spine; spine = &(*spine)->right) {
+        own(*spine);
+        (*spine)->length += length;
+        (*spine)->newlines += newlines;
+        if (!(*spine)->right) {
+            (*spine)->piece.length += length;
+            (*spine)->piece.newlines += newlines;
+        }
+    }
+    return true;
+}
+
+size_t Buffer::size() const {
+    return root ? root->length : 0;
+}
+
+uint64_t Buffer::version() const {
+    return edits;
+}
+
+std::string_view Buffer::original() const {
+    return {storage->original.get(), storage->originalSize};
+}
+
+std::string_view Buffer::unindexed() const {
+    return original().substr(originalIndexed);
+}
+
+Buffer::Snapshot Buffer::originalSlice(size_t offset, size_t length) {
+    assert(offset + length <= storage->originalSize);
+    // The piece's newlines are counted from the index
+    indexAll();
+    Snapshot snapshot;
+    snapshot.storage = storage;
+    if (length > 0) {
+        Piece piece{Source::ORIGINAL, offset, length, 0};
+        piece.newlines = countNewlines(piece, 0, length);
+        snapshot.root = makeNode(piece);
+    }
+    return snapshot;
+}
+
+Buffer::MemoryUse Buffer::memoryUse() const {
+    MemoryUse use{};
+    for (const NewlineTable& positions : newlines) {
+        use.index += positions.bytes();
+    }
+    use.pieces = snapshot().bytes();
+    use.add = storage->add.size() * ADD_BLOCK;
+    return use;
+}
+
+size_t Buffer::lineStart(size_t line) const {
+    assert(line <= lineCount());
+    if (line == 0) {
+        return 0;
+    }
+    // The line starts right after the line-th newline
+    size_t remaining = line;
+    size_t pos = 0;
+    const Node* node = root.get();
+    while (node) {
+        size_t leftNewlines = node->left ? node->left->newlines : 0;
+        if (remaining <= leftNewlines) {
+            node = node->left.get();
+            continue;
+        }
+        remaining -= leftNewlines;
+        pos += node->left ? node->left->length : 0;
+
+        const Piece& piece = node->piece;
+        if (remaining <= piece.newlines) {
+            const NewlineTable& positions = newlinesOf(piece.source);
+            size_t first = positions.lowerBound(piece.start);
+            return pos + positions[first + remaining - 1] - piece.start + 1;
+        }
+        remaining -= piece.newlines;
+        pos += piece.length;
+        node = node->right.get();
+    }
+    return size();
+}
+
+size_t Buffer::offsetOf(size_t line, size_t col) const {
+    assert(line < lineCount());
+    assert(col <= lineLength(line));
+    return lineStart(line) + col;
+}
+
+size_t Buffer::positionOf(size_t line, size_t col) const {
+    if (line == lineCount()) {
+        assert(col == 0);
+        return size();
+    }
+    return offsetOf(line, col);
+}
+
+void Buffer::insertAt(size_t pos, std::string_view text) {
+    if (text.empty()) {
+        return;
+    }
+    ++edits;
+    size_t start = appendAdd(text);
+    size_t newlines = countNewlines({Source::ADD, start, text.size(), 0}, 0, text.size());
+
+    auto [lhs, rhs] = split(std::move(root), pos);
+    // Text starting a fresh slot isn't contiguous with what came before
+    bool contiguous = start % ADD_BLOCK != 0;
+    if (!contiguous || !extendLast(lhs, Source::ADD, start, text.size(), newlines)) {
+        lhs = merge(std::move(lhs), makeNode({Source::ADD, start, text.size(), newlines}));
+    }
+    root = merge(std::move(lhs), std::move(rhs));
+}
+
+void Buffer::eraseAt(size_t pos, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    ++edits;
+    auto [lhs, rest] = split(std::move(root), pos);
+    auto [removed, rhs] = split(std::move(rest), len);
+    root = merge(std::move(lhs), std::move(rhs));
+}
+
+void Buffer::copyRange(const Node* node, size_t pos, size_t len, std::string& out) const {
+    if (!node || len == 0) {
+        return;
+    }
+    size_t leftLength = node->left ? node->left->length : 0;
+    if (pos < leftLength) {
+        copyRange(node->left.get(), pos, std::min(len, leftLength - pos), out);
+    }
+
+    size_t pieceEnd = leftLength + node->piece.length;
+    size_t from = std::max(pos, leftLength);
+    size_t to = std::min(pos + len, pieceEnd);
+    if (from < to) {
+        const Piece& piece = node->piece;
+        out.append(storage->at(piece.source, piece.start + from - leftLength), to - from);
+    }
+
+    if (pos + len > pieceEnd) {
+        size_t rightPos = pos > pieceEnd ? pos - pieceEnd : 0;
+        copyRange(node->right.get(), rightPos, pos + len - std::max(pos, pieceEnd), out);
+    }
+}
+
+std::optional<Buffer::Match> Buffer::find(std::string_view needle, size_t line, size_t col, bool backward) {
+    indexAll();
+    if (needle.empty() || needle.size() > size()) {
+        return std::nullopt;
+    }
+    size_t pos = positionOf(line, col);
+    size_t n = needle.size();
+    // Matches starting after pos, then round from the top up to and
+    // including pos. Backward, those starting before pos, then round from the
+    // bottom
+    std::optional<size_t> found;
+    bool wrapped = false;
+    if (!backward) {
+        found = findIn(needle, pos + 1, size(), false);
+        if (!found) {
+            found = findIn(needle, 0, std::min(size(), pos + n), false);
+            wrapped = true;
+        }
+    }
+    else {
+        found = findIn(needle, 0, std::min(size(), pos + n - 1), true);
+        if (!found) {
+            found = findIn(needle, pos, size(), true);
+            wrapped = true;
+        }
+    }
+    if (!found) {
+        return std::nullopt;
+    }
+    size_t matchLine = lineAt(*found);
+    return Match{matchLine, *found - lineStart(matchLine), wrapped};
+}
+
+void Buffer::collectRuns(const Node* node, size_t offset, size_t from, size_t to, std::vector<Run>& out) const {
+    if (!node || from >= to) {
+        return;
+    }
+    size_t leftLength = node->left ? node->left->length : 0;
+    size_t pieceStart = offset + leftLength;
+    size_t pieceEnd = pieceStart + node->piece.length;
+    if (from < pieceStart) {
+        collectRuns(node->left.get(), offset, from, std::min(to, pieceStart), out);
+    }
+    size_t start = std::max(from, pieceStart);
+    size_t end = std::min(to, pieceEnd);
+    if (start < end) {
+        const Piece& piece = node->piece;
+        out.push_back({start, std::string_view(storage->at(piece.source, piece.start + start - pieceStart), end - start)});
+    }
+    if (to > pieceEnd) {
+        collectRuns(node->right.get(), pieceEnd, std::max(from, pieceEnd), to, out);
+    }
+}
+
+std::optional<size_t> Buffer::findIn(std::string_view needle, size_t from, size_t to, bool backward) const {
+    if (to < from + needle.size()) {
+        return std::nullopt;
+    }
+    std::vector<Run> runs;
+    collectRuns(root.get(), 0, from, to, runs);
+    if (backward) {
+        std::reverse(runs.begin(), runs.end());
+    }
+
+    // A match can straddle runs. Up to n - 1 bytes next to the run, on the
+    // side already scanned, are kept in `carry`, and the join is searched by
+    // putting them together with the run's n - 1 bytes nearest them. A match
+    // can't fit in either part alone, so any found straddles
+    size_t n = needle.size();
+    std::string carry;
+    std::string join;
+    // Where carry starts going forward, or ends going backward
+    size_t carryAt = from;
+    for (const Run& run : runs) {
+        size_t near = std::min(run.text.size(), n - 1);
+        if (!carry.empty()) {
+            if (!backward) {
+                join.assign(carry);
+                join.append(run.text.substr(0, near));
+                size_t at = findSubstring(join.data(), join.size(), needle);
+                if (at != std::string_view::npos) {
+                    return carryAt + at;
+                }
+            }
+            else {
+                join.assign(run.text.substr(run.text.size() - near));
+                join.append(carry);
+                size_t at = findLastSubstring(join.data(), join.size(), needle);
+                if (at != std::string_view::npos) {
+                    return run.offset + run.text.size() - near + at;
+                }
+            }
+        }
+
+        size_t at = backward
+            ? findLastSubstring(run.text.data(), run.text.size(), needle)
+            : findSubstring(run.text.data(), run.text.size(), needle);
+        if (at != std::string_view::npos) {
+            return run.offset + at;
+        }
+
+        if (!backward) {
+            carry.append(run.text.substr(run.text.size() - near));
+            carry.erase(0, carry.size() - std::min(carry.size(), n - 1));
+            carryAt = run.offset + run.text.size() - carry.size();
+        }
+        else {
+            carry.insert(0, run.text.substr(0, near));
+            carry.resize(std::min(carry.size(), n - 1));
+        }
+    }
+    return std::nullopt;
+}
+
+size_t Buffer::lineAt(size_t pos) const {
+    // Newlines before pos
+    size_t line = 0;
+    const Node* node = root.get();
+    while (node) {
+        size_t leftLength = node->left ? node->left->length : 0;
+        if (pos < leftLength) {
+            node = node->left.get();
+            continue;
+        }
+        line += node->left ? node->left->newlines : 0;
+        pos -= leftLength;
+        if (pos < node->piece.length) {
+            return line + countNewlines(node->piece, 0, pos);
+        }
+        line += node->piece.newlines;
+        pos -= node->piece.length;
+        node = node->right.get();
+    }
+    return line;
+}
+
+LineReader::LineReader(const Buffer& buffer) : buffer{buffer}, rowY{-1} {}
+
+const std::string& LineReader::operator()(int y) {
+    if (y != rowY) {
+        rowY = y;
+        if (y >= 0 && y < (int)buffer.lineCount()) {
+            row = buffer.line(y);
+        }
+        else {
+            row.clear();
+        }
+    }
+    return row;
+}
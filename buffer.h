@@ -0,0 +1,308 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "indexer.h"
+#include "newlinetable.h"
+
+// Text buffer backed by a piece table. The text is the concatenation of
+// pieces, each one a span of either the original file or the append-only add
+// buffer. Pieces are kept in an implicit treap ordered by position, with byte
+// and newline counts per subtree, so finding a line and splicing text are
+// O(log n) in the number of pieces regardless of file size.
+//
+// The original file is mapped rather than read, and its newlines are found in
+// the background by a LineIndexer. The tree covers an indexed prefix of the
+// file and the rest is appended to it chunk by chunk, either as ensureLines()
+// asks for more or as collectIndexed() picks up finished chunks. Unedited
+// lines are never copied out of the mapping.
+//
+// Tree nodes are copy-on-write and piece text never moves once written, so
+// snapshot() is O(1) and a snapshot can be read from another thread while the
+// buffer keeps changing.
+//
+// Every line, including the last one, is stored terminated by '\n'.
+class Buffer {
+private:
+    enum class Source : uint8_t {
+        ORIGINAL,
+        ADD
+    };
+
+    struct Piece {
+        Source source;
+        size_t start;
+        size_t length;
+        size_t newlines;
+    };
+
+    struct Node;
+    // Shared between the buffer and its snapshots. A node is only changed in
+    // place while nothing else holds it
+    using NodePtr = std::shared_ptr<Node>;
+
+    struct Node {
+        Piece piece;
+        uint32_t priority;
+        // Totals over the subtree rooted here
+        size_t length;
+        size_t newlines;
+        NodePtr left;
+        NodePtr right;
+    };
+
+    // Size of an add buffer slot
+    static constexpr size_t ADD_BLOCK = 64 << 10;
+
+    // Where piece text lives. Shared with snapshots, which then keep it
+    // alive, and copied before a slot is added while anything shares it
+    struct Storage {
+        // The original file, mapped if it could be
+        std::shared_ptr<const char> original;
+        size_t originalSize;
+        // The add buffer in ADD_BLOCK slots. Text longer than a slot gets one
+        // allocation spanning several, so a piece is always contiguous
+        std::vector<std::shared_ptr<char[]>> add;
+        // Different for every file opened, so pieces are only shared between
+        // a buffer and snapshots of the same text
+        uint64_t id;
+
+        const char* at(Source source, size_t offset) const;
+    };
+    using StoragePtr = std::shared_ptr<const Storage>;
+
+public:
+    // Walks text piece by piece, front to back, without copying it. Only valid
+    // while whatever it came from is unchanged
+    class Spans {
+    public:
+        // Next run of text. Returns false once everything has been seen
+        bool next(std::string_view& span);
+
+    private:
+        friend class Buffer;
+        Spans(const Node* root, const Storage* storage);
+
+        const Storage* storage;
+        std::vector<const Node*> stack;
+
+        void pushLeft(const Node* node);
+    };
+
+    // The text of the buffer at one moment. Unaffected by later edits
+    class Snapshot {
+    public:
+        size_t size() const;
+        size_t newlines() const;
+        Spans spans() const;
+
+        // Heap bytes of the pieces it holds. The text itself lives on in
+        // the file or the add buffer either way
+        size_t bytes() const;
+
+        // Hash of the text, the same for the same bytes however they're split
+        // into pieces
+        uint64_t hash() const;
+
+    private:
+        friend class Buffer;
+        NodePtr root;
+        StoragePtr storage;
+    };
+
+    Buffer();
+    ~Buffer();
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    // Replace the contents with the file at `path`. Returns false with errno
+    // set if it can't be read
+    bool open(const std::string& path);
+
+    // Lines indexed so far. Only the whole file once fullyIndexed()
+    size_t lineCount() const;
+    bool fullyIndexed() const;
+    bool empty() const;
+
+    // Index the original file until at least `lines` lines are known, or it
+    // runs out. Only waits on the chunks needed for that
+    void ensureLines(size_t lines);
+    void indexAll();
+
+    // Take in chunks the indexer has finished, up to `maxChunks`, without
+    // waiting on any
+    void collectIndexed(size_t maxChunks);
+
+    // Whether the indexer has finished the next chunk to take in
+    bool indexReady() const;
+
+    // Percentage of the original file scanned by the indexer
+    int indexProgress() const;
+
+    size_t lineLength(size_t line) const;
+    std::string line(size_t line) const;
+    // Same, into `out`, reusing its capacity
+    void readLine(size_t line, std::string& out) const;
+
+    // Whole indexed buffer, every line terminated by '\n'
+    Spans spans() const;
+    Snapshot snapshot() const;
+
+    // Bytes in the indexed buffer
+    size_t size() const;
+
+    // Changes every time the text does
+    uint64_t version() const;
+
+    // The original file's text. It stays at this address for as long as
+    // the buffer or any snapshot of it is around
+    std::string_view original() const;
+
+    // The end of the original file, not indexed yet, which follows the
+    // indexed buffer as it is
+    std::string_view unindexed() const;
+
+    // Bytes [offset, offset + length) of the original file, to paste without
+    // copying them. Indexes the whole file first
+    Snapshot originalSlice(size_t offset, size_t length);
+
+    // Heap bytes behind the text, for :mem. The mapped file isn't counted
+    struct MemoryUse {
+        size_t index;
+        size_t pieces;
+        size_t add;
+    };
+    MemoryUse memoryUse() const;
+
+    // Insert `text` at line, col. `text` must not contain '\n'
+    void insert(size_t line, size_t col, std::string_view text);
+
+    // Insert `text` at line, col in one go. `text` may span lines. `line`
+    // may be lineCount() to append after the end of the file
+    void insertText(size_t line, size_t col, std::string_view text);
+
+    // Erase `len` characters of `line` starting at col
+    void erase(size_t line, size_t col, size_t len);
+
+    // Text from line1, col1 up to line2, col2, sharing this buffer's pieces
+    // rather than copying them. line2 may be lineCount() with col2 0 to run
+    // to the end
+    Snapshot slice(size_t line1, size_t col1, size_t line2, size_t col2);
+
+    // Same, taking the text out of the buffer in one go
+    Snapshot cut(size_t line1, size_t col1, size_t line2, size_t col2);
+
+    // Insert `text` at line, col. Pieces are shared if it came from this
+    // buffer's text, and copied otherwise. `line` may be lineCount() to
+    // append after the end of the file. Returns the line and column just
+    // past the text
+    std::pair<size_t, size_t> paste(size_t line, size_t col, const Snapshot& text);
+
+    // Insert a new line before `line`. `line` may be lineCount() to append
+    // after the end of the file
+    void insertLine(size_t line, std::string_view text);
+
+    // Break `line` in two at col
+    void splitLine(size_t line, size_t col);
+
+    // Append line + 1 to the end of `line`
+    void joinLines(size_t line);
+
+    struct Match {
+        size_t line;
+        size_t col;
+        // Only found by going round past the end of the buffer, or past the
+        // start going backward
+        bool wrapped;
+    };
+
+    // The next place `needle` occurs after line, col, or the last before it
+    // if `backward`, going round the end of the buffer if need be. Pieces
+    // are scanned where they lie, with the SIMD substring search, and only
+    // the joins between them are copied. Indexes the whole file first
+    std::optional<Match> find(std::string_view needle, size_t line, size_t col, bool backward);
+
+private:
+    std::shared_ptr<Storage> storage;
+    // Bytes of the add buffer used
+    size_t addSize;
+    // Positions of every '\n' indexed so far, per source
+    NewlineTable newlines[2];
+    std::unique_ptr<LineIndexer> indexer;
+    // Next indexer chunk to take in
+    size_t nextChunk;
+    // Original file bytes [0, originalIndexed) are in the tree
+    size_t originalIndexed;
+    NodePtr root;
+    uint64_t edits;
+    std::minstd_rand rng;
+
+    void reset();
+
+    // Take the next chunk of the original file from the indexer and append
+    // its whole lines
+    void indexChunk();
+
+    NewlineTable& newlinesOf(Source s) { return newlines[static_cast<int>(s)]; }
+    const NewlineTable& newlinesOf(Source s) const { return newlines[static_cast<int>(s)]; }
+
+    // Copy `text` to the end of the add buffer. Returns where it starts
+    size_t appendAdd(std::string_view text);
+
+    // Newlines of `piece` in its bytes [from, to)
+    size_t countNewlines(const Piece& piece, size_t from, size_t to) const;
+
+    NodePtr makeNode(const Piece& piece);
+    // Make `node` safe to change, copying it if a snapshot shares it
+    static void own(NodePtr& node);
+    static void update(Node* node);
+    std::pair<NodePtr, NodePtr> split(NodePtr node, size_t pos);
+    static NodePtr merge(NodePtr lhs, NodePtr rhs);
+
+    // Grow the last piece of `node` by `length` bytes if it ends at `end` of
+    // `source`. Keeps typing, and indexing, from making a piece each time
+    static bool extendLast(NodePtr& node, Source source, size_t end, size_t length, size_t newlines);
+
+    // Offset of the first character of `line`. `line` may be lineCount()
+    size_t lineStart(size_t line) const;
+    size_t offsetOf(size_t line, size_t col) const;
+    // Like offsetOf, but `line` may be lineCount()
+    size_t positionOf(size_t line, size_t col) const;
+
+    void insertAt(size_t pos, std::string_view text);
+    void eraseAt(size_t pos, size_t len);
+    void copyRange(const Node* node, size_t pos, size_t len, std::string& out) const;
+
+    // Runs of text in [from, to) of the subtree at `node`, which starts at
+    // `offset`, with where each starts, front to back
+    struct Run {
+        size_t offset;
+        std::string_view text;
+    };
+    void collectRuns(const Node* node, size_t offset, size_t from, size_t to, std::vector<Run>& out) const;
+
+    // Offset of the first or last place `needle` occurs wholly in [from, to)
+    std::optional<size_t> findIn(std::string_view needle, size_t from, size_t to, bool backward) const;
+
+    // Line holding the character at `pos`
+    size_t lineAt(size_t pos) const;
+};
+
+// Reads lines out of a Buffer, keeping the last one fetched. For loops that
+// index into the same row over and over. Rows outside the buffer read as empty
+class LineReader {
+public:
+    explicit LineReader(const Buffer& buffer);
+    const std::string& operator()(int y);
+
+private:
+    const Buffer& buffer;
+    std::string row;
+    int rowY;
+};
@@ -4,29 +4,27 @@
 #include <unordered_map>
 
 #define CTRL_KEY(k) ((k) & 0x1f)
-inline int TAB_STOP = 8;
 
-const std::vector<char> openBrackets = {'{', '(', '['};
-const std::vector<char> closedBrackets = {'}', ')', ']'};
-const std::unordered_map<char, char> bracketMatches = {
-    { '(', ')' },
-    { '{', '}' },
-    { '[', ']' },
-    { ')', '(' },
-    { '}', '{' },
-    { ']', '[' },
+enum EditorKey {
+    BACKSPACE = 127,
+    ARROW_LEFT = 1000,
+    ARROW_RIGHT,
+    ARROW_UP,
+    ARROW_DOWN,
+    PAGE_UP,
+    PAGE_DOWN,
+    HOME_KEY,
+    END_KEY,
+    DEL_KEY,
+    // The terminal has no more input to give
+    INPUT_END,
+    // A bracketed paste came in whole. Its text is in Input::takePaste()
+    PASTE
 };
+
+// Keys that wait for a motion
 const std::unordered_set<char> operators = {
     'd',
     'c',
     'y',
-    '1',
-    '2',
-    '3',
-    '4',
-    '5',
-    '6',
-    '7',
-    '8',
-    '9',
 };
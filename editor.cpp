@@ -1,6 +1,5 @@
 #include <stdio.h>
 #include <cassert>
-#include <stack>
 #include <format>
 #include <fcntl.h>
 #include <string.h>
@@ -11,163 +10,219 @@
 #include <vector>
 #include "editor.h"
 #include "constants.h"
+#include "save.h"
+#include "simd.h"
 #include "utils.h"
 
-Editor::Editor() :
+Editor::Editor(Terminal& terminal) :
     cx{0},
     cy{0},
     rx{0},
+    lastCx{0},
     rowOffset{0},
+    shownRowOffset{0},
     colOffset{0},
+    brackets{buffer},
+    swap{buffer},
+    history{buffer, swap},
     filename{""},
     statusMsgTime{0},
     dirty{false},
+    savedVersion{0},
+    promptCursor{-1},
+    searchBackward{false},
     mode{Mode::NORMAL},
     lineNumberWidth{0},
-    lastCx{0}
+    quitting{false},
+    prompted{false},
+    terminal{terminal},
+    input{terminal},
+    output{terminal},
+    skippedFrames{0},
+    frameWanted{true}
 {
-    auto windowSize = getWindowSize();
-    if (windowSize.has_value()) {
-        std::tie(screenrows, screencols) = windowSize.value();
-    }
-    else {
-        die("getWindowSize");
-    }
+    std::tie(screenrows, screencols) = terminal.size();
     screenrows -= 2;
-    options["number"] = false;
-    options["relativenumber"] = false;
+    renderCache.resize(screenrows);
+    matches.resize(screenrows);
+    screen.resize(screenrows + 2, screencols);
+    renderCache.setTabStop(options.tabStop);
+    matches.setTabStop(options.tabStop);
+    input.escTimeout = options.escTimeout;
+    // Rows are rerendered as they are drawn
+    options.onChange("tabstop", [this] {
+        renderCache.setTabStop(options.tabStop);
+        matches.setTabStop(options.tabStop);
+    });
+    options.onChange("esctimeout", [this] { input.escTimeout = options.escTimeout; });
+    history.setLimit(options.undoMemory * size_t(1024));
+    options.onChange("undomemory", [this] { history.setLimit(options.undoMemory * size_t(1024)); });
+    options.onChange("swapfile", [this] {
+        if (!options.swapFile) {
+            swap.close();
+        }
+    });
 }
 
 int Editor::readKey() {
-    int nread;
-    char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if (nread == -1 && errno != EAGAIN)
-            die("read");
-    }
-
-    if (c == '\x1b') {
-        struct timeval tv;
-        tv.tv_sec = 0;
-        tv.tv_usec = 20000; // 20 ms
-
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(STDIN_FILENO, &readfds);
-
-        if (select(STDIN_FILENO + 1, &readfds, NULL, NULL, &tv) <= 0) {
-            // No more input immediately → plain ESC
-            return '\x1b';
-        }
-
-        char seq[3];
-        if (read(STDIN_FILENO, &seq[0], 1) != 1)
-            return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1)
-            return '\x1b';
-        if (seq[0] == '[') {
-            if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1)
-                    return '\x1b';
-                if (seq[2] == '~') {
-                    switch (seq[1]) {
-                        case '1': return HOME_KEY;
-                        case '3': return DEL_KEY;
-                        case '4': return END_KEY;
-                        case '5': return PAGE_UP;
-                        case '6': return PAGE_DOWN;
-                        case '7': return HOME_KEY;
-                        case '8': return END_KEY;
-                    }
-                }
+    int key;
+    while (true) {
+        auto start = Perf::Clock::now();
+        if (input.next(key)) {
+            perf.record(Perf::DECODE, start);
+            break;
+        }
+
+        // Out of keys for now. Show where they left things, but no more
+        // often than maxfps allows, and only once the terminal has taken the
+        // last frame. Frames that would queue behind it are never made
+        if (!output.flush()) {
+            input.wait(-1, true);
+            continue;
+        }
+        if (frameWanted) {
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(nextFrame - Clock::now());
+            if (wait.count() <= 0) {
+                refreshScreen();
             }
             else {
-                switch (seq[1]) {
-                    case 'A': return ARROW_UP;
-                    case 'B': return ARROW_DOWN;
-                    case 'C': return ARROW_RIGHT;
-                    case 'D': return ARROW_LEFT;
-                    case 'H': return HOME_KEY;
-                    case 'F': return END_KEY;
-                }
+                input.wait(wait.count());
             }
+            continue;
         }
-        else if (seq[0] == 'O') {
-            switch (seq[1]) {
-                case 'H': return HOME_KEY;
-                case 'F': return END_KEY;
-            }
+        if (input.ended()) {
+            return INPUT_END;
+        }
+        // Indexed chunks still to take in, or background work that woke us,
+        // want a frame
+        if (buffer.indexReady() || input.wait()) {
+            frameWanted = true;
         }
-        return '\x1b';
     }
-    else {
-        return c;
+    // Whatever the key does shows up in the next frame. A frame still owed
+    // while the terminal is behind is folded into that one
+    if (frameWanted && output.pending() > 0) {
+        ++skippedFrames;
     }
+    frameWanted = true;
+    return key;
 }
 
 void Editor::appendRow(const std::string& line) {
-    rows.push_back(line);
-    renders.push_back(parseLine(line));
+    size_t end = buffer.lineCount();
+    renderCache.invalidate(end);
+    words.invalidate(end);
+    matches.invalidate(end);
+    history.insert(end, 0, line + '\n');
+    brackets.linesInserted(end, 1);
+}
+
+void Editor::edited(size_t line, long added) {
+    if (buffer.lineCount() == 0) {
+        // Passing through empty, as when undoing a delete of every line
+        renderCache.invalidateFrom(0);
+        words.invalidateFrom(0);
+        matches.invalidateFrom(0);
+        brackets.reset();
+        return;
+    }
+    // An edit at the very end shows up on the last line
+    line = std::min(line, buffer.lineCount() - 1);
+    if (added == 0) {
+        renderCache.invalidate(line);
+        words.invalidate(line);
+        matches.invalidate(line);
+    }
+    else {
+        renderCache.invalidateFrom(line);
+        words.invalidateFrom(line);
+        matches.invalidateFrom(line);
+    }
+    if (added < 0) {
+        brackets.linesRemoved(line + 1, -added);
+    }
+    brackets.lineChanged(line);
+    if (added > 0) {
+        brackets.linesInserted(line + 1, added);
+    }
 }
 
-void Editor::openFile(const std::string& filename) {
+void Editor::openFile(const std::string& filename, bool recover) {
     this->filename = filename;
-    std::ifstream file(filename);
-    if (!file.is_open()) {
+    if (!buffer.open(filename)) {
         die("Failed to open file");
     }
-    std::string line;
-    while (getline(file, line)) {
-        appendRow(line);
+    history.open(filename);
+    if (recover) {
+        // The swap file is left alone if it can't be read
+        auto recovered = swap.recover(filename);
+        if (!recovered) {
+            setStatusMessage(std::format("Can't recover: {}", recovered.error()));
+        }
+        else {
+            setStatusMessage(std::format("Recovered {} changes from the swap file. :w to keep them", *recovered));
+            dirty = true;
+            history.forgetSaved();
+        }
     }
-    file.close();
+    else if (options.swapFile) {
+        auto opened = swap.open(filename);
+        if (!opened) {
+            setStatusMessage(opened.error());
+        }
+    }
+    renderCache.invalidateFrom(0);
+    words.invalidateFrom(0);
+    matches.invalidateFrom(0);
+    brackets.reset();
 }
 
 int Editor::rowCxToRx(const std::string& row, int cx) {
-    int rx = 0;
-    for (int i = 0; i < cx; i++) {
-        if (row[i] == '\t') {
-            rx += (TAB_STOP - 1);
-        }
-        rx++;
-    }
-    return rx;
+    return cxToRx(row.data(), row.size(), cx, options.tabStop);
 }
 
 void Editor::insertNewline() {
     assert(cx >= 0);
-    if (cx == 0) {
-        rows.insert(rows.begin() + cy, "");
-        renders.insert(renders.begin() + cy, "");
-    }
-    else {
-        // Split line at cursor
-        std::string lhs = rows[cy].substr(0, cx);
-        std::string rhs = rows[cy].substr(cx);
-        rows[cy] = lhs;
-        rows.insert(rows.begin() + cy + 1, rhs);
-        renders[cy] = parseLine(rows[cy]);
-        renders.insert(renders.begin() + cy + 1, parseLine(rows[cy + 1]));
-    }
+    // Split line at cursor
+    history.insert(cy, cx, "\n");
+    edited(cy, 1);
     ++cy;
     cx = 0;
     lastCx = cx;
+    dirty = true;
 }
 
 void Editor::insertChar(int c) {
-    if (cy == rows.size()) {
+    if (cy == buffer.lineCount()) {
         appendRow("");
     }
-    rows[cy].insert(rows[cy].begin() + cx, c);
-    renders[cy] = parseLine(rows[cy]);
+    char ch = c;
+    history.insert(cy, cx, std::string_view(&ch, 1));
+    edited(cy);
     cx++;
 
     lastCx = cx - 1;
     dirty = true;
 }
 
+void Editor::insertText(std::string_view text) {
+    if (text.empty()) {
+        return;
+    }
+    if (cy == buffer.lineCount()) {
+        appendRow("");
+    }
+    auto [line, col] = history.insert(cy, cx, text);
+    edited(cy, line - cy);
+    cy = line;
+    cx = col;
+
+    lastCx = std::max(0, cx - 1);
+    dirty = true;
+}
+
 void Editor::deleteChar() {
-    if (cy == rows.size()) {
+    if (cy == buffer.lineCount()) {
         return;
     }
     if (cx == 0 && cy == 0) {
@@ -175,18 +230,15 @@ void Editor::deleteChar() {
     }
 
     if (cx > 0) {
-        rows[cy].erase(rows[cy].begin() + cx - 1);
-        renders[cy] = parseLine(rows[cy]);
+        history.erase(cy, cx - 1, cy, cx);
+        edited(cy);
         --cx;
     }
     else {
         // Concatenate with previous row
-        cx = rows[cy - 1].length();
-        std::string prev = rows[cy - 1];
-        rows[cy - 1] += rows[cy];
-        renders[cy - 1] = parseLine(rows[cy - 1]);
-        rows.erase(rows.begin() + cy);
-        renders.erase(renders.begin() + cy);        
+        cx = buffer.lineLength(cy - 1);
+        history.erase(cy - 1, cx, cy, 0);
+        edited(cy - 1, -1);
         --cy;
     }
     lastCx = std::max(0, cx - 1);
@@ -194,9 +246,22 @@ void Editor::deleteChar() {
 }
 
 void Editor::scroll() {
+  // Pick up what the indexer has done so far, and wait only for what's
+  // needed to fill the screen
+  buffer.collectIndexed(8);
+  buffer.ensureLines(std::max(cy, rowOffset) + screenrows + 1);
+
   rx = cx;
-  if (cy < rows.size()) {
-    rx = rowCxToRx(rows[cy], cx);
+  // Normal mode rests the cursor on the last character of a line. Keep the
+  // column after it in view too
+  int rightmost = rx;
+  if (cy < buffer.lineCount()) {
+    buffer.readLine(cy, cursorLine);
+    rx = rowCxToRx(cursorLine, cx);
+    rightmost = rx;
+    if (mode == Mode::NORMAL && cx == (int)cursorLine.size() - 1) {
+      rightmost = rowCxToRx(cursorLine, cx + 1);
+    }
   }
 
   if (cy < rowOffset) {
@@ -211,140 +276,225 @@ void Editor::scroll() {
   if (rx < colOffset) {
     colOffset = rx;
   }
-  if (rx > colOffset + textCols - 1) {
-    colOffset = rx - textCols + 1;
+  if (rightmost > colOffset + textCols - 1) {
+    colOffset = rightmost - textCols + 1;
   }
 }
 
-void Editor::drawRows(std::string& str) {
-    lineNumberWidth = (options["number"] || options["relativenumber"])
-        ? std::max(4, (int)std::to_string(std::max(1, (int)rows.size())).size() + 1)
+void Editor::drawRows() {
+    lineNumberWidth = (options.number || options.relativeNumber)
+        ? std::max(4, decimalWidth(std::max<size_t>(1, buffer.lineCount())) + 1)
         : 0;
 
     for (int y = 0; y < screenrows; y++) {
         int filerow = y + rowOffset;
 
-        if (filerow >= rows.size()) {
-            str += std::string(lineNumberWidth, ' '); 
-            if (!dirty && filename.empty() && rows.size() == 1 && rows[0].empty() && y == screenrows / 3) {
-                std::string welcome = "Welcome to mirt -- version 0.0.1";
-                int padding = (screencols - welcome.length()) / 2;
+        if (filerow >= buffer.lineCount()) {
+            if (!dirty && filename.empty() && buffer.lineCount() == 1 && buffer.lineLength(0) == 0 && y == screenrows / 3) {
+                std::string_view welcome = "Welcome to mirt -- version 0.0.1";
+                int padding = std::max(0, (screencols - (int)welcome.length()) / 2);
                 if (padding) {
-                    str += "~";
-                    padding--;
-                }
-                while (padding--) {
-                    str += " ";
+                    screen.put(y, lineNumberWidth, "~");
                 }
-                str += welcome;
+                screen.put(y, lineNumberWidth + padding, welcome);
             }
             else {
-                str += "~";
+                screen.put(y, lineNumberWidth, "~");
             }
         }
         else {
-            if (options["number"] || options["relativenumber"]) {
+            if (options.number || options.relativeNumber) {
                 int relativeNumber = std::abs(filerow - cy);
-                std::string lineNumber;
-                if (options["number"] && options["relativenumber"]) {
+                int lineNumber = 0;
+                if (options.number && options.relativeNumber) {
                     if (relativeNumber == 0) {
-                        lineNumber = std::to_string(filerow + 1);
+                        lineNumber = filerow + 1;
                     }
                     else {
-                        lineNumber = std::to_string(relativeNumber);
+                        lineNumber = relativeNumber;
                     }
                 }
-                else if (!options["number"] && options["relativenumber"]) {
-                    lineNumber = std::to_string(relativeNumber);
+                else if (!options.number && options.relativeNumber) {
+                    lineNumber = relativeNumber;
                 }
-                else if (options["number"] && !options["relativenumber"]) {
-                    lineNumber = std::to_string(filerow + 1);
+                else if (options.number && !options.relativeNumber) {
+                    lineNumber = filerow + 1;
                 }
+                scratch.clear();
+                scratch.appendNumber(lineNumber);
 
-                // Dim line numbers
-                str += "\x1b[2m";
-
+                // Dim line numbers. Padding is already blank
                 if (relativeNumber == 0) {
                     // Unindent current line
-                    str += lineNumber + std::string(lineNumberWidth - lineNumber.size() - 1, ' ') + " ";
+                    screen.put(y, 0, scratch.view(), Screen::DIM);
                 }
                 else {
-                    str += std::string(lineNumberWidth - lineNumber.size() - 1, ' ') + lineNumber + " ";
+                    screen.put(y, lineNumberWidth - scratch.size() - 1, scratch.view(), Screen::DIM);
                 }
-                // Reset to normal
-                str += "\x1b[22m";
             }
 
-
             int textCols = screencols - lineNumberWidth;
-            int len = renders[filerow].length() - colOffset;
+            const std::string& render = renderCache.get(buffer, filerow);
+            int len = render.length() - colOffset;
             len = std::max(0, len);
             len = std::min(len, textCols);
             if (len != 0) {
-                str += renders[filerow].substr(colOffset, len);
+                screen.put(y, lineNumberWidth, std::string_view(render).substr(colOffset, len));
             }
+            if (options.hlSearch && !matches.pattern().empty()) {
+                for (const MatchCache::Match& match : matches.get(buffer, filerow)) {
+                    int start = std::max(match.start, colOffset);
+                    int end = std::min(match.end, colOffset + textCols);
+                    if (start < end) {
+                        screen.put(y, lineNumberWidth + start - colOffset,
+                            std::string_view(render).substr(start, end - start), Screen::HIGHLIGHT);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void Editor::drawMatchingBracket() {
+    // scroll() has read the cursor's line
+    if (cy >= buffer.lineCount() || cx >= (int)cursorLine.size()) {
+        return;
+    }
+    int type = BracketIndex::typeOf(cursorLine[cx]);
+    if (type == -1) {
+        return;
+    }
+    bool forward = BracketIndex::isOpen(cursorLine[cx]);
+    size_t depth = 1;
+    size_t col = BracketIndex::scan(cursorLine, forward ? cx + 1 : cx, forward, type, depth);
+    const std::string* text = &cursorLine;
+
+    // Only as far as the screen goes. A match off screen isn't shown anyway
+    int row = cy;
+    int lastRow = std::min<int>(rowOffset + screenrows, buffer.lineCount()) - 1;
+    while (col == std::string::npos) {
+        row += forward ? 1 : -1;
+        if (row < rowOffset || row > lastRow) {
+            return;
         }
+        buffer.readLine(row, bracketLine);
+        text = &bracketLine;
+        col = BracketIndex::scan(bracketLine, forward ? 0 : bracketLine.size(), forward, type, depth);
+    }
 
-        str += "\x1b[K";
-        str += "\r\n";
+    int screenCol = rowCxToRx(*text, col) - colOffset;
+    if (screenCol >= 0 && screenCol < screencols - lineNumberWidth) {
+        screen.put(row - rowOffset, lineNumberWidth + screenCol, std::string_view(*text).substr(col, 1), Screen::INVERSE);
     }
 }
 
-void Editor::drawStatusBar(std::string& str) {
-    str += "\x1b[7m";
-    std::string status = std::format("{:.20} - {} lines {}",
-        filename.empty() ? "[No Name]" : filename,
-        rows.size(),
-        dirty ? "(modified)" : ""
-    );
-    std::string rstatusFormat = "";
-    for (const char c : ops) {
-        rstatusFormat += c;
+void Editor::drawStatusBar() {
+    std::string_view name = filename.empty() ? std::string_view("[No Name]") : std::string_view(filename);
+    statusLine.clear();
+    statusLine.append(name.substr(0, 20));
+    statusLine.append(" - ");
+    if (buffer.fullyIndexed()) {
+        statusLine.appendNumber(buffer.lineCount());
+        statusLine.append(" lines");
     }
-    rstatusFormat += " {}, {}";
-    int yCol = cy + 1;
-    int xCol = cx + 1;
-    std::string rstatus = std::vformat(
-        rstatusFormat,
-        std::make_format_args(yCol, xCol)
-    );
-    while (status.length() < screencols) {
-        if (screencols - status.length() == rstatus.length()) {
-            status += rstatus;
-            break;
+    else {
+        statusLine.append("indexing... ");
+        statusLine.appendNumber(buffer.indexProgress());
+        statusLine.append('%');
+    }
+    statusLine.append(' ');
+    if (dirty) {
+        statusLine.append("(modified)");
+    }
+
+    // Pending operators and the cursor position, flush right if they fit
+    size_t rightLength = ops.size() + 1 + decimalWidth(cy + 1) + 2 + decimalWidth(cx + 1);
+    if (statusLine.size() + rightLength <= (size_t)screencols) {
+        statusLine.fill(' ', screencols - statusLine.size() - rightLength);
+        for (const char c : ops) {
+            statusLine.append(c);
         }
-        status += " ";
+        statusLine.append(' ');
+        statusLine.appendNumber(cy + 1);
+        statusLine.append(", ");
+        statusLine.appendNumber(cx + 1);
+    }
+    else if (statusLine.size() < (size_t)screencols) {
+        statusLine.fill(' ', screencols - statusLine.size());
     }
-    str += status;
-    str += "\x1b[m";
-    str += "\r\n";
+    screen.put(screenrows, 0, statusLine.view(), Screen::INVERSE);
 }
 
-void Editor::drawMessageBar(std::string& str) {
-    str += "\x1b[K";
-    int msglen = statusMsg.length();
-    if (msglen > screencols) msglen = screencols;
-    if (msglen && time(NULL) - statusMsgTime < 5)
-        str += statusMsg;
+void Editor::drawMessageBar() {
+    if (promptCursor != -1) {
+        screen.put(screenrows + 1, 0, promptLine);
+        return;
+    }
+    if (time(NULL) - statusMsgTime < 5) {
+        screen.put(screenrows + 1, 0, statusMsg);
+    }
 }
 
 void Editor::refreshScreen() {
-    scroll();
+    frameWanted = false;
+    nextFrame = Clock::now() + std::chrono::microseconds(1000000 / options.maxFps);
+    pollSave(false);
+    if (auto failed = swap.takeError()) {
+        setStatusMessage(std::format("Swap file: {}", *failed));
+    }
+    uint64_t allocationsBefore = allocationCount();
+    {
+        StageTimer timer(perf, Perf::SCROLL);
+        scroll();
+    }
+
+    // Shift what's already on screen rather than send it again
+    if (!options.fullRedraw) {
+        screen.scroll(0, screenrows, rowOffset - shownRowOffset);
+    }
+    shownRowOffset = rowOffset;
 
-    std::string str;
-    str += "\x1b[?25l";
-    str += "\x1b[H";
-    drawRows(str);
-    drawStatusBar(str);
-    drawMessageBar(str);
+    screen.clear();
+    {
+        StageTimer timer(perf, Perf::DRAW_ROWS);
+        drawRows();
+        drawMatchingBracket();
+    }
+    drawStatusBar();
+    drawMessageBar();
+
+    int cursorRow = cy - rowOffset;
+    int cursorCol = rx - colOffset + lineNumberWidth;
+    if (promptCursor != -1) {
+        cursorRow = screenrows + 1;
+        cursorCol = promptCursor;
+    }
+
+    frame.clear();
+    screen.flush(frame, cursorRow, cursorCol, options.fullRedraw);
+    {
+        StageTimer timer(perf, Perf::WRITE);
+        output.write(frame.view());
+    }
+    perf.frameBytes.add(frame.size());
+    perf.frameAllocations.add(allocationCount() - allocationsBefore);
+}
 
-    // Draw cursor
-    str += "\x1b[" + std::to_string(cy - rowOffset + 1) + ";" 
-        + std::to_string(rx - colOffset + 1 + lineNumberWidth) + "H";
+void Editor::quit() {
+    output.write("\x1b[2J\x1b[H");
+    output.drain();
+    stop();
+}
 
+void Editor::stop() {
+    quitting = true;
+    if (!options.perfFile.empty()) {
+        perf.dump(options.perfFile);
+    }
+}
 
-    str += "\x1b[?25h";
-    write(STDOUT_FILENO, str.c_str(), str.length());
+bool Editor::running() const {
+    return !quitting;
 }
 
 void Editor::setStatusMessage(const std::string& msg) {
@@ -352,15 +502,15 @@ void Editor::setStatusMessage(const std::string& msg) {
     statusMsgTime = time(NULL);
 }
 
-void Editor::moveCursor(int key, Mode mode) {
+void Editor::moveCursor(int key, Mode mode, int count) {
     switch (key) {
         case ARROW_LEFT:
         case 'h': {
             if (cx != 0) {
-                cx--;
+                cx = std::max(0, cx - count);
             } else if (cy > 0 && mode == Mode::INSERT) {
                 cy--;
-                cx = rows[cy].length();
+                cx = buffer.lineLength(cy);
             }
             lastCx = cx;
             break;
@@ -369,15 +519,15 @@ void Editor::moveCursor(int key, Mode mode) {
         case 'l': {
             switch (mode) {
                 case Mode::NORMAL: {
-                    if (cy < rows.size() && cx < (int) rows[cy].length() - 1) {
-                        cx++;
+                    if (cy < buffer.lineCount() && cx < (int)buffer.lineLength(cy) - 1) {
+                        cx = std::min(cx + count, (int)buffer.lineLength(cy) - 1);
                     }
                     break;
                 }
                 case Mode::INSERT:
-                    if (cy < rows.size() && cx < rows[cy].length()) {
-                        cx++;
-                    } else if (cy < rows.size() - 1 && cx == rows[cy].length()) {
+                    if (cy < buffer.lineCount() && cx < buffer.lineLength(cy)) {
+                        cx = std::min(cx + count, (int)buffer.lineLength(cy));
+                    } else if (cy < buffer.lineCount() - 1 && cx == buffer.lineLength(cy)) {
                         cy++;
                         cx = 0;
                     }
@@ -388,64 +538,48 @@ void Editor::moveCursor(int key, Mode mode) {
         }
         case ARROW_UP:
         case 'k': {
-            if (cy != 0) {
-                cy--;
-            }
+            cy = std::max(0, cy - count);
             switch (mode) {
                 case Mode::NORMAL:
-                    cx = std::max(0, std::min(lastCx, (int)rows[cy].size() - 1));
+                    cx = std::max(0, std::min(lastCx, (int)buffer.lineLength(cy) - 1));
                     break;
                 case Mode::INSERT:
-                    cx = std::min(lastCx, (int)rows[cy].size());
+                    cx = std::min(lastCx, (int)buffer.lineLength(cy));
                     break;
             }
             break;
         }
         case ARROW_DOWN:
         case 'j': {
-            if (cy < rows.size() - 1) {
-                cy++;
+            buffer.ensureLines(cy + count + 1);
+            if (cy < (int)buffer.lineCount() - 1) {
+                cy = std::min(cy + count, (int)buffer.lineCount() - 1);
             }
             switch (mode) {
                 case Mode::NORMAL:
-                    cx = std::max(0, std::min(lastCx, (int)rows[cy].size() - 1));
+                    cx = std::max(0, std::min(lastCx, (int)buffer.lineLength(cy) - 1));
                     break;
                 case Mode::INSERT:
-                    cx = std::min(lastCx, (int)rows[cy].size());
+                    cx = std::min(lastCx, (int)buffer.lineLength(cy));
                     break;
             }
             break;
         }
     }
     // Snap cursor to end of line
-    int rowLen = cy < rows.size() ? rows[cy].length() : 0;
+    int rowLen = cy < buffer.lineCount() ? buffer.lineLength(cy) : 0;
     if (cx > rowLen) {
         cx = rowLen;
     }
 
-    // Normal mode end of line
-    if (mode == Mode::NORMAL && cx == rows[cy].length() - 1) {
-        cx++;
-        scroll();
-        cx--;
-        refreshScreen();
-    }
-
     assert(cx >= 0);
     assert(cy >= 0);
 }
 
-std::string Editor::prompt(const std::string& prompt) {
+std::string Editor::prompt(const std::string& prompt, const std::function<void(const std::string&)>& changed) {
+    prompted = true;
     std::string input = "";
-    int rows, cols;
     size_t cursorPos = 0;
-    auto windowSize = getWindowSize();
-    if (windowSize.has_value()) {
-        std::tie(rows, cols) = windowSize.value();
-    }
-    else {
-        die("windowSize");
-    }
 
     size_t placeholderPos = prompt.find("{}");
     std::string before = prompt.substr(0, placeholderPos);
@@ -453,25 +587,14 @@ std::string Editor::prompt(const std::string& prompt) {
                         ? prompt.substr(placeholderPos + 2)
                         : "";
 
+    output.write(THIN_CURSOR);
     while (true) {
-        refreshScreen();
-
-        // Move to bottom line and clear it
-        std::string statusMessage = std::format("\x1b[{};1H\x1b[K", rows);
-
-        // Print prompt
-        statusMessage += before;
-        statusMessage += input;
-        statusMessage += after;
-
-        // Move cursor: start of prompt + position inside input
-        statusMessage += std::format("\x1b[{};{}H", rows, before.size() + cursorPos + 1);
-
-        // Set cursor shape
-        statusMessage += "\x1b[0 q";
-
-        // Write it all at once
-        write(STDOUT_FILENO, statusMessage.c_str(), statusMessage.size());
+        // Drawn on the message bar with the next frame, cursor inside the
+        // input
+        promptLine = before + input + after;
+        promptCursor = before.size() + cursorPos;
+        // Every edit adds or takes away characters
+        size_t length = input.size();
 
         int c = readKey();
         if (c == CTRL_KEY('h') || c == BACKSPACE) {
@@ -485,14 +608,16 @@ std::string Editor::prompt(const std::string& prompt) {
                 input.erase(cursorPos, 1);
             }
         }
-        else if (c == '\x1b') {
+        else if (c == '\x1b' || c == INPUT_END) {
             setStatusMessage("");
-            thickCursor();
+            promptCursor = -1;
+            output.write(THICK_CURSOR);
             return "";
         }
         else if (c == '\r') {
             if (input.length() > 0) {
-                thickCursor();
+                promptCursor = -1;
+                output.write(THICK_CURSOR);
                 return input;
             } 
         }
@@ -502,14 +627,33 @@ std::string Editor::prompt(const std::string& prompt) {
         else if (c == ARROW_RIGHT) {
             if (cursorPos < input.length()) cursorPos++;
         }
+        else if (c == PASTE) {
+            // Only the first line of it, minus control characters
+            for (char ch : this->input.takePaste()) {
+                if (ch == '\n') {
+                    break;
+                }
+                if (!iscntrl(ch)) {
+                    input.insert(cursorPos, 1, ch);
+                    ++cursorPos;
+                }
+            }
+        }
         else if (!iscntrl(c) && c < 128) {
             input.insert(cursorPos, 1, (char)c);
             ++cursorPos;
         }
+        if (changed && input.size() != length) {
+            changed(input);
+        }
     }
 }
 
 bool Editor::save() {
+    if (saver.active()) {
+        setStatusMessage("Save already in progress");
+        return false;
+    }
     if (filename.empty()) {
         filename = prompt("Save as: {} (ESC to cancel)");
         if (filename.empty()) {
@@ -517,173 +661,165 @@ bool Editor::save() {
             return false;
         }
     }
-    std::string data = "";
-    for (const std::string& row : rows) {
-        data += row + "\n";
-    }
-    int fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
-    if (fd == -1) {
-        setStatusMessage(std::format("Can't save! I/O error: {}", strerror(errno)));
-        return false;
-    }
-
-    if (ftruncate(fd, data.length()) != -1) {
-        setStatusMessage(std::format("{} bytes written to disk", data.length()));
-        dirty = false;
-        write(fd, data.c_str(), data.length());
-    }
-    close(fd);
+    buffer.indexAll();
+    savedVersion = buffer.version();
+    savedText = buffer.snapshot();
+    saver.start(filename, savedText);
+    setStatusMessage(std::format("\"{}\" writing...", filename));
     return true;
 }
 
-void Editor::setCommandHandler(const std::string& subCommand) {
-    if (subCommand == "number" || subCommand == "nu") {
-        options["number"] = true;
+bool Editor::pollSave(bool wait) {
+    if (!saver.active()) {
+        return true;
     }
-    else if (subCommand == "nonumber" || subCommand == "nonu") {
-        options["number"] = false;
+    if (!wait && !saver.finished()) {
+        setStatusMessage(std::format("\"{}\" writing... {}%", filename, saver.progress()));
+        return true;
     }
-    if (subCommand == "relativenumber" || subCommand == "rnu") {
-        options["relativenumber"] = true;
+    auto written = saver.collect();
+    Buffer::Snapshot text = std::move(savedText);
+    savedText = {};
+    if (!written.has_value()) {
+        setStatusMessage(std::format("Can't save! I/O error: {}", written.error()));
+        return false;
     }
-    else if (subCommand == "norelativenumber" || subCommand == "nornu") {
-        options["relativenumber"] = false;
+    setStatusMessage(std::format("{} bytes written to disk", written.value()));
+    // The swap file goes on from the file as written, edits since included
+    if (options.swapFile) {
+        swap.saved(filename, std::move(text));
     }
-    else if (subCommand.starts_with("tabstop=")) {
-        int tabStop = std::stoi(subCommand.substr(8));
-        if (tabStop > 0) {
-            TAB_STOP = tabStop;
-            // Rerender the render rows
-            for (int i = 0; i < renders.size(); ++i) {
-                renders[i] = parseLine(rows[i]);
+    // Edits made while writing aren't in the file
+    if (buffer.version() == savedVersion) {
+        dirty = false;
+        history.markSaved();
+        // History is kept with the text it leads to, so only once the file
+        // has what's in the buffer
+        if (options.undoFile) {
+            auto kept = history.save(filename, saver.hash());
+            if (!kept) {
+                setStatusMessage(std::format("Undo file not written: {}", kept.error()));
             }
-            refreshScreen();
         }
     }
-    else {
-        setStatusMessage(std::format("Unknown command: {}", subCommand));
+    return true;
+}
+
+void Editor::setCommandHandler(const std::string& subCommand) {
+    auto shown = options.set(subCommand);
+    if (!shown) {
+        setStatusMessage(shown.error());
+    }
+    else if (!shown->empty()) {
+        setStatusMessage(*shown);
     }
 }
 
-// Returns new cursor position after moving `w` motion
 void Editor::wordMotion(int n, bool dir, WordMotionTarget target) {
-    // True is forward, false is backward
-    auto isKeywordChar = [](char c) {
-        return std::isalnum((unsigned char)c) || c == '_';
-    };
-
-    for (int i = 0; i < n; ++i) {
-        if (dir) {
-            // Forward
-
-            // If past end of file
-            if (cy >= rows.size())
+    if (cy >= (int)buffer.lineCount()) {
+        return;
+    }
+    // w and b stop on empty lines as well as words, like vim. Whole lines
+    // are skipped by counting their stops
+    bool stopAtEmpty = target == WordMotionTarget::START;
+    size_t left = n;
+    size_t line = cy;
+    const WordCache::Bits& current = words.get(buffer, line);
+
+    if (dir) {
+        const std::vector<uint64_t>& stops = stopAtEmpty ? current.starts : current.ends;
+        size_t before = countBits(stops, cx + 1);
+        size_t after = countBits(stops) - before;
+        if (left <= after) {
+            cx = nthBit(stops, before + left);
+            return;
+        }
+        left -= after;
+        while (true) {
+            ++line;
+            buffer.ensureLines(line + 1);
+            if (line >= buffer.lineCount()) {
+                // Out of words. Stop on the last character
+                cy = buffer.lineCount() - 1;
+                cx = std::max(0, (int)buffer.lineLength(cy) - 1);
                 return;
-
-            int oldcx = cx;
-            // --- 1. If we're in the middle of a word, skip to its end ---
-            if (!rows[cy].empty() && cx < (int)rows[cy].size() && !std::isspace((unsigned char)rows[cy][cx])) {
-                bool currIsKeyword = isKeywordChar(rows[cy][cx]);
-                while (cx < (int)rows[cy].size() && isKeywordChar(rows[cy][cx]) == currIsKeyword) {
-                    cx++;
-                }
-                if (target == WordMotionTarget::END) {
-                    --cx;
-                    if (oldcx == cx) {
-                        ++cx;
-                    }
-                }
-            }
-
-            // --- 2. If we're at or past end of line, go to next line ---
-            if (cx >= (int)rows[cy].size()) {
-                cy++;
-                cx = 0;
-
             }
-
-            // Skip empty lines and whitespace lines
-            while (true) {
-                if (cy >= (int)rows.size()) {
-                    --cy;
+            const WordCache::Bits& bits = words.get(buffer, line);
+            if (bits.length == 0) {
+                if (stopAtEmpty && --left == 0) {
+                    cy = line;
+                    cx = 0;
                     return;
                 }
-                if (cy < (int)rows.size() && rows[cy].empty()) {
-                    // Mimic Vim behavior -- stop at first non-empty line
-                    if (target == WordMotionTarget::START) {
-                        break;
-                    }
-                    ++cy;
-                    continue;
-                }
-                else if (cy < (int)rows.size() && std::isspace((unsigned char)rows[cy][cx])) {
-                    ++cx;
-                    if (cx >= (int)rows[cy].size()) {
-                        ++cy;
-                        cx = 0;
-                    }
-                    continue;
-                }
-                break;
-            }
-
-            if (target == WordMotionTarget::END) {
-                bool currIsKeyword = isKeywordChar(rows[cy][cx]);
-                while (cx < (int)rows[cy].size() && isKeywordChar(rows[cy][cx]) == currIsKeyword) {
-                    cx++;
-                }
-                --cx;
                 continue;
             }
-        }
-        else {
-            // Backward
-            // If at beginning of file
-            if (cy == 0 && cx == 0)
+            const std::vector<uint64_t>& lineStops = stopAtEmpty ? bits.starts : bits.ends;
+            size_t count = countBits(lineStops);
+            if (left <= count) {
+                cy = line;
+                cx = nthBit(lineStops, left);
                 return;
-
-            // --- 1. If we're in the middle of a word, skip to its start ---
-            if (!rows[cy].empty() && cx > 0 && !std::isspace((unsigned char)rows[cy][cx - 1])) {
-                bool currIsKeyword = isKeywordChar(rows[cy][cx - 1]);
-                while (cx > 0 && isKeywordChar(rows[cy][cx - 1]) == currIsKeyword) {
-                    cx--;
-                }
-                continue;
-            }
-
-            // --- 2. If we're at or past start of line, go to previous line ---
-            if (cx == 0) {
-                cy--;
-                cx = rows[cy].size();
-            }
-
-            // --- 3. Skip whitespace to get to previous word ---
-            while (cy >= 0 && std::isspace((unsigned char)rows[cy][cx - 1])) {
-                cx--;
-                if (cx == 0) {
-                    cy--;
-                    cx = rows[cy].size();
-                }
             }
+            left -= count;
+        }
+    }
 
-            // -- 4. Move to beginning of word
-            bool currIsKeyword = isKeywordChar(rows[cy][cx - 1]);
-            while (cx > 0 && isKeywordChar(rows[cy][cx - 1]) == currIsKeyword) {
-                cx--;
+    size_t before = countBits(current.starts, cx);
+    if (left <= before) {
+        cx = nthBit(current.starts, before - left + 1);
+        return;
+    }
+    left -= before;
+    while (line > 0) {
+        --line;
+        const WordCache::Bits& bits = words.get(buffer, line);
+        if (bits.length == 0) {
+            if (--left == 0) {
+                cy = line;
+                cx = 0;
+                return;
             }
-
+            continue;
+        }
+        size_t count = countBits(bits.starts);
+        if (left <= count) {
+            cy = line;
+            cx = nthBit(bits.starts, count - left + 1);
+            return;
         }
+        left -= count;
     }
+    cy = 0;
+    cx = 0;
 }
 
-
 void Editor::processNormalKey(int c) {
-    if (operators.contains(c)) {
-        ops.push_back(c);
+    // Each command is one undo step, along with any typing it leads into
+    history.endStep();
+    if (pendKey(c)) {
+        return;
+    }
+    Pending pending = takePending();
+    int count = pending.count;
+    int n = std::max(1, count);
+    if (pending.g && c != 'g') {
+        // gg is the only g command
+        return;
+    }
+    if (pending.op) {
+        applyOperator(pending, c);
         return;
     }
-    ops.clear();
     switch(c) {
+        case PASTE:
+            // Goes in before the cursor as if typed in insert mode, leaving
+            // the cursor on its last character
+            insertText(input.takePaste());
+            if (cx > 0) {
+                --cx;
+            }
+            break;
+
         case ':': {
             std::string command = prompt(":{}");
             if (command.empty()) {
@@ -694,29 +830,45 @@ void Editor::processNormalKey(int c) {
                 save();
             }
             else if (command == "wq") {
-                if (!save()) {
+                if (!save() || !pollSave(true)) {
                     return;
                 }
-                write(STDOUT_FILENO, "\x1b[2J", 4);
-                write(STDOUT_FILENO, "\x1b[H", 3);
-                exit(0);
+                quit();
             }
             else if (command == "q!") {
-                write(STDOUT_FILENO, "\x1b[2J", 4);
-                write(STDOUT_FILENO, "\x1b[H", 3);
-                exit(0);
+                // Don't leave a half-written temp file behind
+                pollSave(true);
+                quit();
             }
             else if (command == "q") {
+                pollSave(true);
                 if (dirty) {
                     setStatusMessage("Unsaved changes. (add ! to override)");
                     return;
                 }
                 else {
-                    write(STDOUT_FILENO, "\x1b[2J", 4);
-                    write(STDOUT_FILENO, "\x1b[H", 3);
-                    exit(0);
+                    quit();
                 }
             }
+            else if (command == "perf") {
+                setStatusMessage(perf.summary());
+            }
+            else if (command == "mem") {
+                Buffer::MemoryUse use = buffer.memoryUse();
+                size_t overhead = use.index + use.pieces + use.add + brackets.bytes();
+                size_t lines = std::max<size_t>(1, buffer.lineCount());
+                setStatusMessage(std::format(
+                    "mem: {} lines, {} bytes of text, {:.1f} bytes/line on top (index {}, pieces {}, added {}, brackets {})",
+                    buffer.lineCount(), buffer.size(), (double)overhead / lines,
+                    use.index, use.pieces, use.add, brackets.bytes()
+                ));
+            }
+            else if (command == "outq") {
+                setStatusMessage(std::format(
+                    "output queue: {} bytes pending, {} max, {} stalled writes, {} frames skipped",
+                    output.pending(), output.maxPending, output.stalls, skippedFrames
+                ));
+            }
             else if (command.starts_with("set ")) {
                 std::string subCommand = command.substr(4);
                 setCommandHandler(subCommand); 
@@ -727,11 +879,11 @@ void Editor::processNormalKey(int c) {
         case 'j':
         case 'k':
         case 'l':
-            moveCursor(c, mode);
+            moveCursor(c, mode, n);
             break;
         
         case 'a': {
-            if (!rows[cy].empty()) {
+            if (buffer.lineLength(cy) != 0) {
                 ++cx;
                 lastCx = cx;
             }
@@ -753,54 +905,82 @@ void Editor::processNormalKey(int c) {
             break;
         case END_KEY:
         case '$': {
-            if (cy < rows.size()) {
-                cx = std::max(0, (int) rows[cy].length() - 1);
+            if (cy < buffer.lineCount()) {
+                cx = std::max(0, (int)buffer.lineLength(cy) - 1);
                 lastCx = cx;
-                if (cx == rows[cy].length() - 1) {
-                    cx++;
-                    scroll();
-                    cx--;
-                    refreshScreen();
-                }
             }
             break;
         }
         case 'G': {
-            cy = rows.size() - 1;
+            // To line `count`, or the last line
+            if (count > 0) {
+                buffer.ensureLines(count);
+                cy = std::min<int>(count, buffer.lineCount()) - 1;
+            }
+            else {
+                buffer.indexAll();
+                cy = buffer.lineCount() - 1;
+            }
             cx = 0;
         }
         case '_': {
-            size_t first = firstNonWhitespace(rows[cy]);
+            size_t first = firstNonWhitespace(buffer.line(cy));
             cx = first;
             lastCx = cx;
             break;
         }
+        case 'g': {
+            // gg: to line `count`, or the first line
+            buffer.ensureLines(n);
+            cy = std::min<int>(n, buffer.lineCount()) - 1;
+            cx = firstNonWhitespace(buffer.line(cy));
+            lastCx = cx;
+            break;
+        }
+        case 'p':
+        case 'P':
+            put(pending.reg, c == 'p', n);
+            break;
+        case '/':
+        case '?':
+            searchPrompt(c == '?', n);
+            break;
+        case 'n':
+        case 'N':
+            searchNext(c == 'N', n);
+            break;
+        case 'u':
+        case CTRL_KEY('r'):
+            undo(c == 'u', n);
+            break;
         case 'w': {
-            wordMotion(1, true, WordMotionTarget::START);
+            wordMotion(n, true, WordMotionTarget::START);
             lastCx = cx;
             break;
         }
         case 'e': {
-            wordMotion(1, true, WordMotionTarget::END);
+            wordMotion(n, true, WordMotionTarget::END);
             lastCx = cx;
             break;
         }
         case 'b': {
-            wordMotion(1, false, WordMotionTarget::START);
+            wordMotion(n, false, WordMotionTarget::START);
             lastCx = cx;
             break;
         }
         case '%': {
-            if (rows[cy].empty()) {
+            if (count > 0) {
+                // To `count` percent of the way through the file
+                buffer.indexAll();
+                int lines = buffer.lineCount();
+                cy = std::clamp((std::min(count, 100) * lines + 99) / 100 - 1, 0, lines - 1);
+                cx = firstNonWhitespace(buffer.line(cy));
+                lastCx = cx;
                 break;
             }
-            if (std::find(openBrackets.begin(), openBrackets.end(), rows[cy].at(cx)) != openBrackets.end()) {
-                // Look forward
-                std::tie(cy, cx) = findBracket(true);
-            }
-            else if (std::find(closedBrackets.begin(), closedBrackets.end(), rows[cy].at(cx)) != closedBrackets.end()) {
-                // Look backwards
-                std::tie(cy, cx) = findBracket(false);
+            auto match = brackets.match(cy, cx);
+            if (match) {
+                std::tie(cy, cx) = *match;
             }
             lastCx = cx;
             break;
@@ -810,63 +990,363 @@ void Editor::processNormalKey(int c) {
     assert(cy >= 0);
 }
 
-std::pair<int, int> Editor::findBracket(bool dir) {
-    // Forward is true, backwards is false
-    int curCx = cx;
-    int curCy = cy;
-    std::stack<char> brackets;
-
-    char orig = rows[curCy][curCx];
-    brackets.push(rows[curCy][curCx]);
-    while (!brackets.empty()) {
-        if (dir) {
-            if (curCy >= rows.size()) {
-                // Not found
-                return {cy, cx};
-            }
-            // Scan forward
-            ++curCx;
-            if (curCx >= rows[curCy].size()) {
-                ++curCy;
-                curCx = 0;
-                while (rows[curCy].empty()) {
-                    ++curCy;
-                    if (curCy >= rows.size()) {
-                        // Not found
-                        return {cy, cx};
-                    }
-                }
-            }
+void Editor::searchPrompt(bool backward, int count) {
+    int startY = cy;
+    int startX = cx;
+    int startLastCx = lastCx;
+    std::string pattern = prompt(backward ? "?{}" : "/{}", [&](const std::string& typed) {
+        // Drawn with the next frame: the cursor on the first match of what's
+        // typed so far, every match on screen highlighted
+        cy = startY;
+        cx = startX;
+        matches.setPattern(typed);
+        if (typed.empty()) {
+            return;
+        }
+        auto match = buffer.find(typed, cy, cx, backward);
+        if (match) {
+            cy = match->line;
+            cx = match->col;
+        }
+    });
+    cy = startY;
+    cx = startX;
+    lastCx = startLastCx;
+    if (pattern.empty()) {
+        // Back to highlighting the last search
+        matches.setPattern(searchPattern);
+        return;
+    }
+    searchPattern = pattern;
+    searchBackward = backward;
+    matches.setPattern(searchPattern);
+    searchNext(false, count);
+}
+
+bool Editor::searchNext(bool reverse, int count) {
+    if (searchPattern.empty()) {
+        setStatusMessage("No previous search");
+        return false;
+    }
+    bool backward = searchBackward != reverse;
+    size_t line = cy;
+    size_t col = cx;
+    bool wrapped = false;
+    for (int i = 0; i < count; ++i) {
+        auto match = buffer.find(searchPattern, line, col, backward);
+        if (!match) {
+            setStatusMessage(std::format("Pattern not found: {}", searchPattern));
+            return false;
+        }
+        line = match->line;
+        col = match->col;
+        wrapped = wrapped || match->wrapped;
+    }
+    cy = line;
+    cx = col;
+    lastCx = cx;
+    if (wrapped) {
+        setStatusMessage(backward ? "search hit TOP, continuing at BOTTOM" : "search hit BOTTOM, continuing at TOP");
+    }
+    else {
+        setStatusMessage(std::format("{}{}", backward ? '?' : '/', searchPattern));
+    }
+    return true;
+}
 
+bool Editor::pendKey(int c) {
+    if (!ops.empty() && ops.back() == '"') {
+        // Register name. Anything else cancels
+        if (c < 128 && Registers::valid(c)) {
+            ops.push_back(c);
         }
         else {
-            // Scan backward
-            if (curCy < 0) {
-                // Not found
-                return {cy, cx};
-            }
-            --curCx;
-            if (curCx < 0) {
-                --curCy;
-                curCx = rows[curCy].size() - 1;
-                while (rows[curCy].empty()) {
-                    --curCy;
-                    if (curCy < 0) {
-                        return {cy, cx};
-                    }
-                    curCx = rows[curCy].size() - 1;
-                }
+            ops.clear();
+        }
+        return true;
+    }
+    if (!ops.empty() && ops.back() == 'g') {
+        return false;
+    }
+    bool hasOperator = std::any_of(ops.begin(), ops.end(), [](char op) {
+        return operators.contains(op);
+    });
+    // 0 is a motion unless it's part of a count
+    bool digit = (c >= '1' && c <= '9') || (c == '0' && !ops.empty() && std::isdigit(ops.back()));
+    if (digit || c == 'g' || (c < 128 && !hasOperator && (c == '"' || operators.contains(c)))) {
+        ops.push_back(c);
+        return true;
+    }
+    return false;
+}
+
+Editor::Pending Editor::takePending() {
+    // Large enough for any line number, small enough not to overflow
+    const long long MAX_COUNT = 1 << 30;
+    Pending pending;
+    // Counts before and after the operator multiply, as in 2d3w
+    long long counts[2] = {0, 0};
+    int part = 0;
+    for (size_t i = 0; i < ops.size(); ++i) {
+        char op = ops[i];
+        if (op == '"' && i + 1 < ops.size()) {
+            char name = ops[++i];
+            pending.reg = name == '"' ? 0 : name;
+        }
+        else if (std::isdigit(op)) {
+            counts[part] = std::min(MAX_COUNT, counts[part] * 10 + (op - '0'));
+        }
+        else if (operators.contains(op)) {
+            pending.op = op;
+            part = 1;
+        }
+        else if (op == 'g') {
+            pending.g = true;
+        }
+    }
+    if (counts[0] || counts[1]) {
+        pending.count = std::min(MAX_COUNT, std::max(1LL, counts[0]) * std::max(1LL, counts[1]));
+    }
+    ops.clear();
+    return pending;
+}
+
+void Editor::applyOperator(const Pending& pending, int motion) {
+    if (cy >= (int)buffer.lineCount()) {
+        return;
+    }
+    int n = std::max(1, pending.count);
+    int startY = cy;
+    int startX = cx;
+    int startLastCx = lastCx;
+    bool linewise = false;
+    // Whether the motion's target is part of the text operated on
+    bool inclusive = false;
+    bool moved = true;
+
+    switch (motion) {
+        case 'd':
+        case 'c':
+        case 'y':
+            // dd, cc, yy: `n` whole lines
+            if (motion != pending.op) {
+                return;
             }
+            linewise = true;
+            buffer.ensureLines(cy + n);
+            cy = std::min<int>(cy + n, buffer.lineCount()) - 1;
+            break;
+        case 'j':
+        case 'k':
+        case ARROW_DOWN:
+        case ARROW_UP:
+            linewise = true;
+            moveCursor(motion, Mode::NORMAL, n);
+            moved = cy != startY;
+            break;
+        case 'G':
+            linewise = true;
+            if (pending.count > 0) {
+                buffer.ensureLines(pending.count);
+                cy = std::min<int>(pending.count, buffer.lineCount()) - 1;
+            }
+            else {
+                buffer.indexAll();
+                cy = buffer.lineCount() - 1;
+            }
+            break;
+        case 'g':
+            if (!pending.g) {
+                return;
+            }
+            linewise = true;
+            buffer.ensureLines(n);
+            cy = std::min<int>(n, buffer.lineCount()) - 1;
+            break;
+        case 'w': {
+            std::string line = buffer.line(cy);
+            if (pending.op == 'c' && cx < (int)line.size() && !std::isspace((unsigned char)line[cx])) {
+                // cw on a word changes to the end of it, like ce. Starting a
+                // column back counts the end under the cursor
+                --cx;
+                wordMotion(n, true, WordMotionTarget::END);
+                inclusive = true;
+                break;
+            }
+            wordMotion(n, true, WordMotionTarget::START);
+            const WordCache::Bits& bits = words.get(buffer, cy);
+            bool onStop = bits.length == 0 || (bits.starts[cx / 64] >> (cx % 64) & 1);
+            if (!onStop) {
+                // Ran out of words, so the last character goes too
+                inclusive = true;
+            }
+            else if (cy > startY && cx <= (int)firstNonWhitespace(buffer.line(cy))) {
+                // A word at the end of a line ends the text there, rather
+                // than it running on to the next line's first word
+                --cy;
+                cx = buffer.lineLength(cy);
+            }
+            break;
         }
-        char ch = rows[curCy][curCx];
-        if (orig == ch) {
-            brackets.push(rows[curCy][curCx]);
+        case 'e':
+            wordMotion(n, true, WordMotionTarget::END);
+            inclusive = true;
+            break;
+        case 'b':
+            wordMotion(n, false, WordMotionTarget::START);
+            break;
+        case 'h':
+        case ARROW_LEFT:
+            moved = cx > 0;
+            cx = std::max(0, cx - n);
+            break;
+        case 'l':
+        case ARROW_RIGHT:
+            cx = std::min<int>(cx + n, buffer.lineLength(cy));
+            moved = cx != startX;
+            break;
+        case '0':
+            cx = 0;
+            break;
+        case '$':
+            cx = std::max(0, (int)buffer.lineLength(cy) - 1);
+            inclusive = true;
+            break;
+        case 'n':
+        case 'N':
+            moved = searchNext(motion == 'N', n);
+            break;
+        case '%': {
+            auto match = brackets.match(cy, cx);
+            if (!match) {
+                return;
+            }
+            std::tie(cy, cx) = *match;
+            inclusive = true;
+            break;
         }
-        else if (bracketMatches.contains(ch) && brackets.top() == bracketMatches.at(ch)) {
-            brackets.pop(); 
+        default:
+            return;
+    }
+
+    int endY = cy;
+    int endX = std::max(0, cx);
+    cy = startY;
+    cx = startX;
+    lastCx = startLastCx;
+    if (!moved) {
+        return;
+    }
+
+    if (linewise) {
+        operate(pending, std::min(startY, endY), 0, std::max(startY, endY), 0, true);
+        return;
+    }
+    if (std::tie(endY, endX) < std::tie(startY, startX)) {
+        std::swap(startY, endY);
+        std::swap(startX, endX);
+    }
+    if (inclusive) {
+        endX = std::min<int>(endX + 1, buffer.lineLength(endY));
+    }
+    operate(pending, startY, startX, endY, endX, false);
+}
+
+void Editor::operate(const Pending& pending, size_t line1, size_t col1, size_t line2, size_t col2, bool linewise) {
+    // Linewise text runs through the newline ending line2
+    size_t endLine = linewise ? line2 + 1 : line2;
+    size_t endCol = linewise ? 0 : col2;
+    size_t lines = line2 - line1 + 1;
+
+    if (pending.op == 'y') {
+        registers.yank(pending.reg, {buffer.slice(line1, col1, endLine, endCol), linewise});
+        cy = line1;
+        cx = linewise ? std::min<int>(cx, std::max(0, (int)buffer.lineLength(cy) - 1)) : col1;
+        if (linewise && lines > 2) {
+            setStatusMessage(std::format("{} lines yanked", lines));
         }
+        lastCx = cx;
+        return;
+    }
+
+    if (pending.op == 'c' && linewise) {
+        // The lines are replaced by one empty line to type into
+        registers.remove(pending.reg, {buffer.slice(line1, 0, endLine, 0), true});
+        size_t end = buffer.lineLength(line2);
+        history.erase(line1, 0, line2, end);
+        edited(line1, -(long)(line2 - line1));
+        cy = line1;
+        cx = 0;
+        lastCx = 0;
+        dirty = true;
+        setInsert();
+        return;
+    }
+
+    Buffer::Snapshot text = history.erase(line1, col1, endLine, endCol);
+    registers.remove(pending.reg, {std::move(text), linewise});
+    dirty = true;
+    if (linewise) {
+        if (buffer.empty()) {
+            // Leave a line for the cursor
+            appendRow("");
+        }
+        edited(line1, -(long)lines);
+        cy = std::min<size_t>(line1, buffer.lineCount() - 1);
+        cx = firstNonWhitespace(buffer.line(cy));
+        if (lines > 2) {
+            setStatusMessage(std::format("{} fewer lines", lines));
+        }
+    }
+    else {
+        edited(line1, -(long)(line2 - line1));
+        cy = line1;
+        cx = col1;
+        if (pending.op == 'd') {
+            // Normal mode keeps the cursor on a character
+            cx = std::min<int>(cx, std::max(0, (int)buffer.lineLength(cy) - 1));
+        }
+    }
+    lastCx = cx;
+    if (pending.op == 'c') {
+        setInsert();
     }
-    return {curCy, curCx};
+}
+
+void Editor::put(char name, bool after, int count) {
+    const Registers::Register* reg = registers.get(name);
+    if (!reg || reg->text.size() == 0) {
+        setStatusMessage("Nothing in register");
+        return;
+    }
+    if (cy >= (int)buffer.lineCount()) {
+        return;
+    }
+    long lines = reg->text.newlines() * count;
+
+    // Each copy goes after the last, so they're one change to undo
+    if (reg->linewise) {
+        size_t at = after ? cy + 1 : cy;
+        std::pair<size_t, size_t> end{at, 0};
+        for (int i = 0; i < count; ++i) {
+            end = history.paste(end.first, end.second, reg->text);
+        }
+        edited(at == 0 ? 0 : at - 1, lines);
+        cy = at;
+        cx = firstNonWhitespace(buffer.line(cy));
+    }
+    else {
+        size_t col = after && buffer.lineLength(cy) > 0 ? cx + 1 : cx;
+        std::pair<size_t, size_t> end{cy, col};
+        for (int i = 0; i < count; ++i) {
+            end = history.paste(end.first, end.second, reg->text);
+        }
+        edited(cy, lines);
+        // On the last character put, or the first if it spans lines
+        cx = lines == 0 ? col + reg->text.size() * count - 1 : col;
+    }
+    lastCx = cx;
+    dirty = true;
 }
 
 void Editor::processInsertKey(int c) {
@@ -892,11 +1372,15 @@ void Editor::processInsertKey(int c) {
             break;
 
         case END_KEY:
-            if (cy < rows.size())
-                cx = std::max(0, (int) rows[cy].length());
+            if (cy < buffer.lineCount())
+                cx = std::max(0, (int)buffer.lineLength(cy));
                 lastCx = cx;
             break;
 
+        case PASTE:
+            insertText(input.takePaste());
+            break;
+
         default:
             insertChar(c);
             break;
@@ -905,6 +1389,28 @@ void Editor::processInsertKey(int c) {
 
 void Editor::processKeyPress() {
     int c = readKey();
+    if (c == INPUT_END) {
+        // Nothing will ever come again
+        pollSave(true);
+        if (dirty) {
+            // Edits not saved are kept in the swap file, all of it synced,
+            // as after a crash
+            swap.preserve();
+        }
+        stop();
+        return;
+    }
+
+    StageTimer timer(perf, Perf::DISPATCH);
+    prompted = false;
+    dispatchKey(c);
+    // Time spent waiting on the user in a prompt isn't dispatch
+    if (prompted) {
+        timer.cancel();
+    }
+}
+
+void Editor::dispatchKey(int c) {
     // Common between both modes
     switch (c) {
         case PAGE_UP:
@@ -913,11 +1419,10 @@ void Editor::processKeyPress() {
                 cy = rowOffset;
             } else if (c == PAGE_DOWN) {
                 cy = rowOffset + screenrows - 1;
-                if (cy > rows.size()) cy = rows.size();
+                buffer.ensureLines(cy + 1);
+                if (cy >= (int)buffer.lineCount()) cy = buffer.lineCount() - 1;
             }
-            int times = screenrows;
-            while (times--)
-                moveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN, mode);
+            moveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN, mode, screenrows);
             return;
         }
 
@@ -944,19 +1449,42 @@ void Editor::processKeyPress() {
 }
 
 void Editor::appendIfBufferEmpty() {
-    if (rows.empty()) {
+    if (buffer.empty()) {
         appendRow("");
+        // The line an empty file opens with isn't an edit
+        history.clear();
+    }
+}
+
+void Editor::undo(bool undo, int count) {
+    std::optional<std::pair<size_t, size_t>> at;
+    for (int i = 0; i < count; ++i) {
+        auto step = undo
+            ? history.undo([this](size_t line, long added) { edited(line, added); })
+            : history.redo([this](size_t line, long added) { edited(line, added); });
+        if (!step) {
+            break;
+        }
+        at = step;
     }
+    if (!at) {
+        setStatusMessage(undo ? "Already at oldest change" : "Already at newest change");
+        return;
+    }
+    cy = std::min(at->first, buffer.lineCount() - 1);
+    cx = std::min<int>(at->second, std::max(0, (int)buffer.lineLength(cy) - 1));
+    lastCx = cx;
+    dirty = history.modified();
 }
 
 void Editor::setInsert() {
-    thinCursor();
+    output.write(THIN_CURSOR);
     mode = Mode::INSERT;
     setStatusMessage("-- INSERT --");
 }
 
 void Editor::setNormal() {
-    thickCursor();
+    output.write(THICK_CURSOR);
     mode = Mode::NORMAL;
     setStatusMessage("-- NORMAL --");
 }
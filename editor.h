@@ -1,8 +1,25 @@
 #pragma once
+#include <chrono>
+#include <functional>
 #include <vector>
 #include <unordered_map>
 #include <string>
 #include <termios.h>
+#include "appendbuffer.h"
+#include "bracketindex.h"
+#include "buffer.h"
+#include "input.h"
+#include "matchcache.h"
+#include "options.h"
+#include "output.h"
+#include "perf.h"
+#include "registers.h"
+#include "rendercache.h"
+#include "save.h"
+#include "screen.h"
+#include "terminal.h"
+#include "undo.h"
+#include "wordcache.h"
 
 class Editor {
 private:
@@ -17,43 +34,80 @@ private:
     int screenrows;
     int screencols;
     int rowOffset;
+    // rowOffset as of the last frame drawn
+    int shownRowOffset;
     int colOffset;
-    std::vector<std::string> rows;
-    std::vector<std::string> renders;
+    Buffer buffer;
+    RenderCache renderCache;
+    WordCache words;
+    MatchCache matches;
+    BracketIndex brackets;
+    Registers registers;
+    SwapFile swap;
+    UndoJournal history;
     std::string filename;
     std::string statusMsg;
     time_t statusMsgTime;
     bool dirty;
+    BackgroundSave saver;
+    // Buffer version the running save was taken at, and its text
+    uint64_t savedVersion;
+    Buffer::Snapshot savedText;
+    Screen screen;
+    // Reused from frame to frame so drawing doesn't allocate
+    AppendBuffer frame;
+    AppendBuffer statusLine;
+    AppendBuffer scratch;
+    std::string cursorLine;
+    std::string bracketLine;
+    // Prompt shown on the message bar, and the cursor's column in it. -1
+    // while not prompting
+    std::string promptLine;
+    int promptCursor;
+    // Last pattern searched for, and whether with ?
+    std::string searchPattern;
+    bool searchBackward;
     Mode mode;
     int lineNumberWidth;
-    std::unordered_map<std::string, bool> options;
+    Options options;
     std::vector<char> ops;
-
-    enum EditorKey {
-        BACKSPACE = 127,
-        ARROW_LEFT = 1000,
-        ARROW_RIGHT,
-        ARROW_UP,
-        ARROW_DOWN,
-        PAGE_UP,
-        PAGE_DOWN,
-        HOME_KEY,
-        END_KEY,
-        DEL_KEY
-    };
+    bool quitting;
+    Perf perf;
+    // A prompt ran during the key being handled
+    bool prompted;
+    Terminal& terminal;
+    Input input;
+    Output output;
+    // Frames not drawn because the terminal hadn't taken the last one yet
+    size_t skippedFrames;
+
+    using Clock = std::chrono::steady_clock;
+    // Something changed since the last frame. Frames are drawn when input
+    // runs dry, at most options.maxFps a second
+    bool frameWanted;
+    Clock::time_point nextFrame;
 
     enum class WordMotionTarget {
         START,
         END
     };
 
+    // Next key, waiting for one. Draws a frame whenever it runs out of keys
+    // and something has changed
     int readKey();
     void appendRow(const std::string& line);
+    // Bring what's kept about lines up to date after an edit: `line` changed
+    // and `added` lines after it were inserted, or removed if negative
+    void edited(size_t line, long added = 0);
     int rowCxToRx(const std::string& row, int cx);
 
     // Insert character at cy, cx
     void insertChar(int c);
 
+    // Insert `text`, which may span lines, at cy, cx as one edit. The cursor
+    // ends up after it
+    void insertText(std::string_view text);
+
     // Delete character at cy, cx
     void deleteChar();
 
@@ -61,16 +115,33 @@ private:
     void insertNewline();
 
     void scroll();
-    void drawRows(std::string& str);
-    void drawStatusBar(std::string& str);
-    void drawMessageBar(std::string& str);
-    void moveCursor(int key, Mode mode);
+    // Draw into the back grid of `screen`
+    void drawRows();
+    // Highlight the bracket matching the one under the cursor, if it's on
+    // screen
+    void drawMatchingBracket();
+    void drawStatusBar();
+    void drawMessageBar();
+    void moveCursor(int key, Mode mode, int count = 1);
     
-    // Returns if save was successful
+    // Clear the screen and stop running
+    void quit();
+    void stop();
+
+    // Act on a key in the current mode
+    void dispatchKey(int c);
+
+    // Start writing the buffer out in the background. Returns if a save was
+    // started
     bool save();
 
-    // Prompt the user for input. Returns the user input
-    std::string prompt(const std::string& prompt);
+    // Report on a running save, taking its result if it's finished or if
+    // `wait` is set. Returns false if the save failed
+    bool pollSave(bool wait);
+
+    // Prompt the user for input. Returns the user input. `changed` is called
+    // with the input every time it's edited
+    std::string prompt(const std::string& prompt, const std::function<void(const std::string&)>& changed = {});
 
     void processInsertKey(int c);
     void processNormalKey(int c);
@@ -78,21 +149,67 @@ private:
     void setInsert();
     void setNormal();
 
-    void setCommandHandler(const std::string& subCommand);
+
+    // What was typed before a normal mode command
+    struct Pending {
+        // 0 if none was given
+        int count = 0;
+        // d, c or y, or 0 for a plain motion
+        char op = 0;
+        // Register named with ", or 0 for the default
+        char reg = 0;
+        // Waiting on the second g of gg
+        bool g = false;
+    };
+
+    // Add `c` to ops if it's part of a command still being typed: a count,
+    // a register, an operator or g. Returns whether it was taken
+    bool pendKey(int c);
+
+    // Parse and clear ops
+    Pending takePending();
+
+    // Apply pending.op over the text `motion` moves across, or whole lines
+    // for a linewise motion or a doubled operator (dd)
+    void applyOperator(const Pending& pending, int motion);
+
+    // Yank, delete or change from line1, col1 up to line2, col2, or lines
+    // line1 to line2 if `linewise`
+    void operate(const Pending& pending, size_t line1, size_t col1, size_t line2, size_t col2, bool linewise);
+
+    // p and P: put register `name` after or before the cursor `count` times
+    void put(char name, bool after, int count);
+
+    // u and Ctrl-R: undo or redo `count` steps
+    void undo(bool undo, int count);
 
     // Move cursor in direction `dir` by `n` words
     void wordMotion(int n, bool dir, WordMotionTarget target);
 
-    std::pair<int, int> findBracket(bool dir);
+    // / and ?: prompt for a pattern, going to its first match and
+    // highlighting every match as it's typed, then search for it `count`
+    // times
+    void searchPrompt(bool backward, int count);
+
+    // n and N: go to the `count`th match of the last pattern, searching the
+    // way it was searched, or the other way if `reverse`. Returns whether
+    // there was one
+    bool searchNext(bool reverse, int count);
 
 public:
-    Editor();
-    void openFile(const std::string& filename);
+    explicit Editor(Terminal& terminal);
+    void openFile(const std::string& filename, bool recover = false);
     void refreshScreen();
     void processKeyPress();
+    // False once the user has quit or input has ended
+    bool running() const;
     void setStatusMessage(const std::string& msg);
     void appendIfBufferEmpty();
 
+    // Apply :set arguments, e.g. "nu tabstop=4", reporting queries and
+    // errors on the message bar. .mirtrc goes through here too
+    void setCommandHandler(const std::string& subCommand);
+
     // Open .mirtrc in same dir as mirt executable
     void config();
 };
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <poll.h>
+#include <string.h>
+#include "headless.h"
+#include "utils.h"
+
+HeadlessTerminal::HeadlessTerminal(int rows, int cols, std::string keys) :
+    rows{rows},
+    cols{cols},
+    keys{std::move(keys)},
+    next{0},
+    readTo{0},
+    handling{false},
+    sinkAtStart{0}
+{}
+
+std::pair<int, int> HeadlessTerminal::size() {
+    return {rows, cols};
+}
+
+size_t HeadlessTerminal::keyLength(size_t pos) const {
+    if (keys[pos] != '\x1b' || pos + 1 == keys.size()) {
+        return 1;
+    }
+    static const char PASTE_START[] = "\x1b[200~";
+    static const char PASTE_END[] = "\x1b[201~";
+    if (keys.compare(pos, strlen(PASTE_START), PASTE_START) == 0) {
+        size_t end = keys.find(PASTE_END, pos);
+        return end == std::string::npos ? keys.size() - pos : end + strlen(PASTE_END) - pos;
+    }
+    if (keys[pos + 1] == 'O') {
+        return std::min<size_t>(3, keys.size() - pos);
+    }
+    if (keys[pos + 1] != '[') {
+        return 1;
+    }
+    for (size_t i = pos + 2; i < keys.size(); ++i) {
+        if (keys[i] >= 0x40 && keys[i] <= 0x7e) {
+            return i + 1 - pos;
+        }
+    }
+    return keys.size() - pos;
+}
+
+ssize_t HeadlessTerminal::read(char* buf, size_t len) {
+    if (readTo == next) {
+        return next == keys.size() && !handling ? -1 : 0;
+    }
+    size_t n = std::min(len, next - readTo);
+    memcpy(buf, keys.data() + readTo, n);
+    readTo += n;
+    return n;
+}
+
+size_t HeadlessTerminal::write(const char* buf, size_t len) {
+    sink.append(buf, len);
+    return len;
+}
+
+void HeadlessTerminal::finishKey() {
+    if (handling) {
+        latencies.push_back(Clock::now() - since);
+        bytes.push_back(sink.size() - sinkAtStart);
+        handling = false;
+    }
+}
+
+bool HeadlessTerminal::wait(int timeout, bool writable) {
+    if (timeout == -1 && !writable) {
+        // Idle: that's the end of the last key. Hand over the next one
+        finishKey();
+        if (next < keys.size()) {
+            next += keyLength(next);
+            handling = true;
+            since = Clock::now();
+            sinkAtStart = sink.size();
+        }
+        return false;
+    }
+    // Waiting out a timer; only background work can end it early
+    struct pollfd pfd = {wakeupFd(), POLLIN, 0};
+    if (poll(&pfd, 1, std::max(timeout, 0)) == 1) {
+        drainWakeups();
+        return true;
+    }
+    return false;
+}
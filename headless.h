@@ -0,0 +1,47 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "terminal.h"
+
+// A terminal with no screen, for benchmarks. Keys come from a recorded
+// stream and are handed over one at a time, the next only once the editor
+// has gone idle after the last, so each key's latency and output can be
+// measured. Output is kept in memory.
+class HeadlessTerminal : public Terminal {
+public:
+    HeadlessTerminal(int rows, int cols, std::string keys);
+
+    // Everything written so far
+    std::string sink;
+
+    // Per key, from handing it over to the editor going idle again
+    std::vector<std::chrono::nanoseconds> latencies;
+    // Per key, bytes written while handling it
+    std::vector<size_t> bytes;
+
+    std::pair<int, int> size() override;
+    ssize_t read(char* buf, size_t len) override;
+    size_t write(const char* buf, size_t len) override;
+    bool wait(int timeout, bool writable) override;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    int rows;
+    int cols;
+    std::string keys;
+    // keys[0, next) have been handed over, keys[read, next) not read yet
+    size_t next;
+    size_t readTo;
+    // The key being handled, if any
+    bool handling;
+    Clock::time_point since;
+    size_t sinkAtStart;
+
+    // Length of the key starting at keys[pos]: a byte, an escape sequence
+    // or a whole bracketed paste
+    size_t keyLength(size_t pos) const;
+    void finishKey();
+};
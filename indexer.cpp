@@ -0,0 +1,89 @@
+#include <algorithm>
+#include "indexer.h"
+#include "simd.h"
+#include "utils.h"
+
+LineIndexer::LineIndexer(const char* data, size_t size) :
+    data{data},
+    size{size},
+    count{(size + CHUNK_SIZE - 1) / CHUNK_SIZE},
+    nextChunk{0},
+    scanned{0},
+    stopping{false}
+{
+    chunks = std::make_unique<Chunk[]>(count);
+    for (size_t i = 0; i < count; ++i) {
+        chunks[i].state = State::PENDING;
+    }
+    // The first chunk is wanted right away and scanned by whoever takes it
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, count > 0 ? count - 1 : 0);
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back(&LineIndexer::work, this);
+    }
+}
+
+LineIndexer::~LineIndexer() {
+    stopping = true;
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+size_t LineIndexer::chunkCount() const {
+    return count;
+}
+
+size_t LineIndexer::chunkEnd(size_t chunk) const {
+    return std::min(size, (chunk + 1) * CHUNK_SIZE);
+}
+
+size_t LineIndexer::chunksScanned() const {
+    return scanned;
+}
+
+bool LineIndexer::ready(size_t chunk) const {
+    return chunks[chunk].state == State::DONE;
+}
+
+std::vector<uint32_t> LineIndexer::take(size_t chunk) {
+    if (!scan(chunk)) {
+        std::unique_lock<std::mutex> lock(mutex);
+        chunkDone.wait(lock, [&] { return ready(chunk); });
+    }
+    return std::move(chunks[chunk].newlines);
+}
+
+void LineIndexer::work() {
+    while (!stopping) {
+        size_t chunk = nextChunk++;
+        if (chunk >= count) {
+            return;
+        }
+        scan(chunk);
+        // Let the editor take it in and update progress
+        wakeMainLoop();
+    }
+}
+
+bool LineIndexer::scan(size_t chunk) {
+    State expected = State::PENDING;
+    if (!chunks[chunk].state.compare_exchange_strong(expected, State::SCANNING)) {
+        return expected == State::DONE;
+    }
+
+    std::vector<uint32_t> newlines;
+    size_t start = chunk * CHUNK_SIZE;
+    findNewlines(data + start, chunkEnd(chunk) - start, newlines);
+    // Kept for as long as the file is open
+    newlines.shrink_to_fit();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        chunks[chunk].newlines = std::move(newlines);
+        chunks[chunk].state = State::DONE;
+    }
+    ++scanned;
+    chunkDone.notify_all();
+    return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Finds the newlines of a file's contents on a pool of worker threads. The
+// text is split into fixed-size chunks that workers claim front to back, each
+// producing its own table of newline offsets. The owner collects the tables in
+// order with take(), which only waits on the chunk asked for, and scans it on
+// the spot if no worker has got to it yet.
+class LineIndexer {
+public:
+    // Bytes scanned per chunk
+    static constexpr size_t CHUNK_SIZE = 4 << 20;
+
+    // `data` must stay valid and unchanged until the indexer is destroyed
+    LineIndexer(const char* data, size_t size);
+    ~LineIndexer();
+    LineIndexer(const LineIndexer&) = delete;
+    LineIndexer& operator=(const LineIndexer&) = delete;
+
+    size_t chunkCount() const;
+    size_t chunkEnd(size_t chunk) const;
+
+    // Chunks finished so far, in any order
+    size_t chunksScanned() const;
+
+    bool ready(size_t chunk) const;
+
+    // Offsets of the newlines in `chunk` from its start, waiting for it if
+    // needed. Each chunk can be taken once
+    std::vector<uint32_t> take(size_t chunk);
+
+private:
+    enum class State {
+        PENDING,
+        SCANNING,
+        DONE
+    };
+
+    struct Chunk {
+        std::atomic<State> state;
+        std::vector<uint32_t> newlines;
+    };
+
+    const char* data;
+    size_t size;
+    std::unique_ptr<Chunk[]> chunks;
+    size_t count;
+    std::atomic<size_t> nextChunk;
+    std::atomic<size_t> scanned;
+    std::atomic<bool> stopping;
+    std::mutex mutex;
+    std::condition_variable chunkDone;
+    std::vector<std::thread> workers;
+
+    void work();
+
+    // Scan `chunk` if nobody has claimed it yet. Returns false if taken
+    bool scan(size_t chunk);
+};
@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <string.h>
+#include "constants.h"
+#include "input.h"
+
+Input::Input(Terminal& terminal) :
+    escTimeout{20},
+    terminal{terminal},
+    inputEnded{false},
+    head{0},
+    tail{0},
+    escPending{false},
+    pasting{false}
+{}
+
+void Input::fill() {
+    while (available() < CAPACITY) {
+        size_t start = tail % CAPACITY;
+        size_t room = std::min(CAPACITY - available(), CAPACITY - start);
+        ssize_t nread = terminal.read(ring + start, room);
+        if (nread == -1) {
+            inputEnded = true;
+            return;
+        }
+        if (nread == 0) {
+            return;
+        }
+        tail += nread;
+    }
+}
+
+bool Input::wait(int timeout, bool writable) {
+    if (escPending) {
+        auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - escSince);
+        int escLeft = std::max<int>(0, escTimeout - waited.count());
+        timeout = timeout == -1 ? escLeft : std::min(timeout, escLeft);
+    }
+    bool woken = terminal.wait(timeout, writable);
+    fill();
+    return woken;
+}
+
+bool Input::ended() const {
+    return inputEnded && available() == 0 && !pasting;
+}
+
+size_t Input::sequenceLength() const {
+    if (available() < 2) {
+        return 0;
+    }
+    unsigned char kind = at(1);
+    if (kind == 'O') {
+        return available() >= 3 ? 3 : 0;
+    }
+    if (kind != '[') {
+        // Not a sequence, just ESC followed by a key
+        return 1;
+    }
+    // CSI: parameters, intermediates, then one final byte
+    for (size_t i = 2; i < available(); ++i) {
+        unsigned char c = at(i);
+        if (c >= 0x40 && c <= 0x7e) {
+            return i + 1;
+        }
+        if (c < 0x20 || c > 0x3f) {
+            // Malformed. Take the ESC on its own
+            return 1;
+        }
+    }
+    return 0;
+}
+
+bool Input::sequenceIs(size_t length, const char* sequence) const {
+    if (length != strlen(sequence)) {
+        return false;
+    }
+    for (size_t i = 0; i < length; ++i) {
+        if (at(i) != (unsigned char)sequence[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int Input::decodeSequence(size_t length) const {
+    if (length == 3 && at(1) == 'O') {
+        switch (at(2)) {
+            case 'H': return HOME_KEY;
+            case 'F': return END_KEY;
+        }
+    }
+    else if (length == 3) {
+        switch (at(2)) {
+            case 'A': return ARROW_UP;
+            case 'B': return ARROW_DOWN;
+            case 'C': return ARROW_RIGHT;
+            case 'D': return ARROW_LEFT;
+            case 'H': return HOME_KEY;
+            case 'F': return END_KEY;
+        }
+    }
+    else if (length == 4 && at(3) == '~') {
+        switch (at(2)) {
+            case '1': return HOME_KEY;
+            case '3': return DEL_KEY;
+            case '4': return END_KEY;
+            case '5': return PAGE_UP;
+            case '6': return PAGE_DOWN;
+            case '7': return HOME_KEY;
+            case '8': return END_KEY;
+        }
+    }
+    return '\x1b';
+}
+
+// Bracketed paste markers
+static const char PASTE_START[] = "\x1b[200~";
+static const char PASTE_END[] = "\x1b[201~";
+
+bool Input::readPaste() {
+    const size_t endLength = strlen(PASTE_END);
+    while (available() > 0) {
+        // Copy up to the next ESC in one go
+        const char* run = ring + head % CAPACITY;
+        size_t length = std::min(available(), CAPACITY - head % CAPACITY);
+        const char* esc = static_cast<const char*>(memchr(run, '\x1b', length));
+        if (!esc) {
+            paste.append(run, length);
+            head += length;
+            continue;
+        }
+        paste.append(run, esc - run);
+        head += esc - run;
+
+        size_t have = std::min(available(), endLength);
+        bool prefix = true;
+        for (size_t i = 0; i < have && prefix; ++i) {
+            prefix = at(i) == (unsigned char)PASTE_END[i];
+        }
+        if (!prefix) {
+            paste += '\x1b';
+            ++head;
+        }
+        else if (have < endLength) {
+            // The end marker may still be on its way
+            return false;
+        }
+        else {
+            head += endLength;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string Input::takePaste() {
+    std::string text;
+    text.reserve(paste.size());
+    for (size_t i = 0; i < paste.size(); ++i) {
+        if (paste[i] != '\r') {
+            text += paste[i];
+        }
+        // Terminals send Enter as \r, some as \r\n
+        else if (i + 1 == paste.size() || paste[i + 1] != '\n') {
+            text += '\n';
+        }
+    }
+    paste.clear();
+    return text;
+}
+
+bool Input::next(int& key) {
+    if (pasting) {
+        if (!readPaste()) {
+            if (!inputEnded) {
+                return false;
+            }
+            // Cut off before the end marker. What came is the whole paste,
+            // along with any start of a marker that never finished
+            for (; available() > 0; ++head) {
+                paste += at(0);
+            }
+        }
+        pasting = false;
+        key = PASTE;
+        return true;
+    }
+    if (available() == 0) {
+        return false;
+    }
+    if (at(0) != '\x1b') {
+        key = at(0);
+        ++head;
+        return true;
+    }
+
+    size_t length = sequenceLength();
+    if (length == 0) {
+        // Give the rest of the sequence escTimeout to show up
+        if (!escPending) {
+            escPending = true;
+            escSince = Clock::now();
+        }
+        if (Clock::now() - escSince < std::chrono::milliseconds(escTimeout)) {
+            return false;
+        }
+        length = 1;
+    }
+    escPending = false;
+    if (sequenceIs(length, PASTE_START)) {
+        head += length;
+        pasting = true;
+        paste.clear();
+        return next(key);
+    }
+    key = length == 1 ? '\x1b' : decodeSequence(length);
+    head += length;
+    return true;
+}
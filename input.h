@@ -0,0 +1,65 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include "terminal.h"
+
+// Keys read from the terminal. Input is read in large chunks into a ring
+// buffer and decoded from there a key at a time, so a burst of keys costs one
+// read and an escape sequence never blocks on the rest of itself.
+class Input {
+public:
+    explicit Input(Terminal& terminal);
+
+    // Decode the next key. Returns false if there isn't a whole one yet. A
+    // lone ESC only counts as the Escape key once escTimeout passes without
+    // the rest of a sequence
+    bool next(int& key);
+
+    // Text of the paste just returned as PASTE, with line ends as '\n'
+    std::string takePaste();
+
+    // Sleep until there's input, the escape timeout or `timeout` ms run out,
+    // the terminal can take more output if `writable` is set, or another
+    // thread calls wakeMainLoop(). Returns true if woken up by another thread
+    bool wait(int timeout = -1, bool writable = false);
+
+    // The terminal has no more input to give, and every key has been decoded
+    bool ended() const;
+
+    // Milliseconds to wait for the rest of an escape sequence
+    int escTimeout;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t CAPACITY = 1 << 16;
+
+    Terminal& terminal;
+    bool inputEnded;
+    char ring[CAPACITY];
+    // Bytes [head, tail) are unread. Both only grow; wrap with % CAPACITY
+    size_t head;
+    size_t tail;
+    // When the ESC at head came in, if it's waiting on the rest of a sequence
+    bool escPending;
+    Clock::time_point escSince;
+    // Inside a bracketed paste, collecting its text until the end marker
+    bool pasting;
+    std::string paste;
+
+    // Read everything the terminal has, as far as the ring has room
+    void fill();
+
+    size_t available() const { return tail - head; }
+    unsigned char at(size_t i) const { return ring[(head + i) % CAPACITY]; }
+
+    // Length of the escape sequence at head, or 0 if it's not all in yet
+    size_t sequenceLength() const;
+    bool sequenceIs(size_t length, const char* sequence) const;
+    int decodeSequence(size_t length) const;
+
+    // Move paste text out of the ring. Returns true once the end marker is
+    // reached
+    bool readPaste();
+};
@@ -1,18 +1,26 @@
+#include <signal.h>
+#include <string_view>
 #include "utils.h"
 #include "editor.h"
+#include "terminal.h"
 
 int main(int argc, char** argv) {
+    // A hangup is taken as input ending, so edits not saved are kept
+    signal(SIGHUP, SIG_IGN);
     enableRawMode();
-    Editor e;
+    TtyTerminal terminal;
+    Editor e(terminal);
     e.config();
-    if (argc >= 2) {
+    e.setStatusMessage(":q to quit");
+    if (argc >= 3 && std::string_view(argv[1]) == "-r") {
+        e.openFile(argv[2], true);
+    }
+    else if (argc >= 2) {
         e.openFile(argv[1]);
     }
-    e.setStatusMessage(":q to quit");
     e.appendIfBufferEmpty();
 
-    while (1) {
-        e.refreshScreen();
+    while (e.running()) {
         e.processKeyPress();
     }
     return 0;
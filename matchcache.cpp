@@ -0,0 +1,69 @@
+#include <algorithm>
+#include "matchcache.h"
+#include "simd.h"
+
+MatchCache::MatchCache() : generation{0}, tabStop{8} {
+    resize(1);
+}
+
+void MatchCache::resize(size_t capacity) {
+    entries.assign(std::max<size_t>(1, capacity), Entry{false, 0, 0, {}});
+}
+
+const std::vector<MatchCache::Match>& MatchCache::get(const Buffer& buffer, size_t line) {
+    Entry& entry = entries[line % entries.size()];
+    if (!entry.valid || entry.line != line || entry.generation != generation) {
+        entry.matches.clear();
+        if (!searched.empty()) {
+            buffer.readLine(line, text);
+            size_t pos = 0;
+            while (pos < text.size()) {
+                size_t at = findSubstring(text.data() + pos, text.size() - pos, searched);
+                if (at == std::string_view::npos) {
+                    break;
+                }
+                at += pos;
+                pos = at + searched.size();
+                entry.matches.push_back({
+                    cxToRx(text.data(), text.size(), at, tabStop),
+                    cxToRx(text.data(), text.size(), pos, tabStop)
+                });
+            }
+        }
+        entry.valid = true;
+        entry.line = line;
+        entry.generation = generation;
+    }
+    return entry.matches;
+}
+
+void MatchCache::invalidate(size_t line) {
+    Entry& entry = entries[line % entries.size()];
+    if (entry.line == line) {
+        entry.valid = false;
+    }
+}
+
+void MatchCache::invalidateFrom(size_t line) {
+    for (Entry& entry : entries) {
+        if (entry.line >= line) {
+            entry.valid = false;
+        }
+    }
+}
+
+void MatchCache::setPattern(std::string_view pattern) {
+    if (pattern != searched) {
+        searched = pattern;
+        ++generation;
+    }
+}
+
+const std::string& MatchCache::pattern() const {
+    return searched;
+}
+
+void MatchCache::setTabStop(int tabStop) {
+    this->tabStop = tabStop;
+    ++generation;
+}
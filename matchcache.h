@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "buffer.h"
+
+// Where the search pattern occurs in the rows being drawn, as render columns,
+// for highlighting. Entries are found with the SIMD substring search the first
+// time a row is drawn and dropped per line on edit, like RenderCache. A new
+// pattern or tab stop makes every entry stale.
+class MatchCache {
+public:
+    // Render columns [start, end)
+    struct Match {
+        int start;
+        int end;
+    };
+
+    MatchCache();
+
+    // Number of rows kept, normally the screen height
+    void resize(size_t capacity);
+
+    // Matches in `line`, found in `buffer` if not cached. Valid until the
+    // next call
+    const std::vector<Match>& get(const Buffer& buffer, size_t line);
+
+    void invalidate(size_t line);
+
+    // Drop `line` and everything after it, for when lines shift
+    void invalidateFrom(size_t line);
+
+    // Look for `pattern` from now on. Empty matches nothing
+    void setPattern(std::string_view pattern);
+    const std::string& pattern() const;
+
+    void setTabStop(int tabStop);
+
+private:
+    struct Entry {
+        bool valid;
+        size_t line;
+        uint64_t generation;
+        std::vector<Match> matches;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t generation;
+    int tabStop;
+    std::string searched;
+    std::string text;
+};
@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <cassert>
+#include "newlinetable.h"
+
+size_t NewlineTable::size() const {
+    return count;
+}
+
+size_t NewlineTable::operator[](size_t i) const {
+    assert(i < count);
+    const Block& block = blockOf(i);
+    return block.base + block.offsets[i - block.first];
+}
+
+size_t NewlineTable::lowerBound(size_t pos) const {
+    // Last block starting at or before pos. Anything past its end belongs to
+    // the next block, whose first index is where such a search stops anyway
+    auto next = std::upper_bound(blocks.begin(), blocks.end(), pos, [](size_t pos, const Block& block) {
+        return pos < block.base;
+    });
+    if (next == blocks.begin()) {
+        return 0;
+    }
+    const Block& block = *(next - 1);
+    uint64_t relative = pos - block.base;
+    if (relative > UINT32_MAX) {
+        return block.first + block.offsets.size();
+    }
+    auto found = std::lower_bound(block.offsets.begin(), block.offsets.end(), static_cast<uint32_t>(relative));
+    return block.first + (found - block.offsets.begin());
+}
+
+void NewlineTable::append(size_t base, std::vector<uint32_t> offsets) {
+    if (offsets.empty()) {
+        return;
+    }
+    if (!blocks.empty() && offsets.size() < MIN_BLOCK) {
+        Block& last = blocks.back();
+        if (base + offsets.back() - last.base <= UINT32_MAX) {
+            for (uint32_t offset : offsets) {
+                last.offsets.push_back(base + offset - last.base);
+            }
+            count += offsets.size();
+            return;
+        }
+    }
+    count += offsets.size();
+    blocks.push_back({base, count - offsets.size(), std::move(offsets)});
+}
+
+void NewlineTable::clear() {
+    blocks.clear();
+    count = 0;
+}
+
+size_t NewlineTable::bytes() const {
+    size_t bytes = blocks.capacity() * sizeof(Block);
+    for (const Block& block : blocks) {
+        bytes += block.offsets.capacity() * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+const NewlineTable::Block& NewlineTable::blockOf(size_t i) const {
+    auto next = std::upper_bound(blocks.begin(), blocks.end(), i, [](size_t i, const Block& block) {
+        return i < block.first;
+    });
+    return *(next - 1);
+}
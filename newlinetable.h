@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Ascending byte offsets of newlines, 4 bytes each rather than 8. Offsets are
+// kept in blocks, each holding them relative to its own base. A block is
+// normally one indexer chunk's table moved in whole, so indexing a file never
+// copies its offsets or regrows one huge array.
+class NewlineTable {
+public:
+    size_t size() const;
+    size_t operator[](size_t i) const;
+
+    // Index of the first offset at or after `pos`
+    size_t lowerBound(size_t pos) const;
+
+    // Add `offsets` plus `base`. They must come after every offset so far
+    void append(size_t base, std::vector<uint32_t> offsets);
+
+    void clear();
+
+    // Heap bytes held
+    size_t bytes() const;
+
+private:
+    // Appends smaller than this are copied into the last block, so typing
+    // doesn't make a block per line
+    static constexpr size_t MIN_BLOCK = 4096;
+
+    struct Block {
+        size_t base;
+        // Index of the block's first offset in the table
+        size_t first;
+        std::vector<uint32_t> offsets;
+    };
+
+    std::vector<Block> blocks;
+    size_t count = 0;
+
+    // Block holding offset index `i`
+    const Block& blockOf(size_t i) const;
+};
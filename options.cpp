@@ -0,0 +1,164 @@
+#include <charconv>
+#include <format>
+#include <iterator>
+#include "options.h"
+
+namespace {
+
+enum class Kind {
+    BOOL,
+    INT,
+    STRING
+};
+
+struct Spec {
+    std::string_view name;
+    std::string_view alias;
+    Kind kind;
+    // The field the option lives in. Only the one for `kind` is set
+    bool Options::* flag;
+    int Options::* number;
+    std::string Options::* text;
+    // Smallest value an INT may take
+    int min;
+};
+
+constexpr Spec specs[] = {
+    {.name = "number", .alias = "nu", .kind = Kind::BOOL, .flag = &Options::number},
+    {.name = "relativenumber", .alias = "rnu", .kind = Kind::BOOL, .flag = &Options::relativeNumber},
+    {.name = "fullredraw", .kind = Kind::BOOL, .flag = &Options::fullRedraw},
+    {.name = "tabstop", .alias = "ts", .kind = Kind::INT, .number = &Options::tabStop, .min = 1},
+    {.name = "esctimeout", .kind = Kind::INT, .number = &Options::escTimeout, .min = 0},
+    {.name = "maxfps", .kind = Kind::INT, .number = &Options::maxFps, .min = 1},
+    {.name = "undomemory", .kind = Kind::INT, .number = &Options::undoMemory, .min = 0},
+    {.name = "undofile", .alias = "udf", .kind = Kind::BOOL, .flag = &Options::undoFile},
+    {.name = "swapfile", .alias = "swf", .kind = Kind::BOOL, .flag = &Options::swapFile},
+    {.name = "hlsearch", .alias = "hls", .kind = Kind::BOOL, .flag = &Options::hlSearch},
+    {.name = "perffile", .kind = Kind::STRING, .text = &Options::perfFile},
+};
+
+const Spec* find(std::string_view name) {
+    for (const Spec& spec : specs) {
+        if (name == spec.name || (!spec.alias.empty() && name == spec.alias)) {
+            return &spec;
+        }
+    }
+    return nullptr;
+}
+
+std::string show(const Options& options, const Spec& spec) {
+    switch (spec.kind) {
+        case Kind::BOOL:
+            return std::format("{}{}", options.*spec.flag ? "" : "no", spec.name);
+        case Kind::INT:
+            return std::format("{}={}", spec.name, options.*spec.number);
+        case Kind::STRING:
+            return std::format("{}={}", spec.name, options.*spec.text);
+    }
+    return "";
+}
+
+}
+
+std::expected<std::string, std::string> Options::set(std::string_view args) {
+    std::string shown;
+    while (!args.empty()) {
+        size_t end = args.find(' ');
+        std::string_view arg = args.substr(0, end);
+        args = end == std::string_view::npos ? "" : args.substr(end + 1);
+        if (arg.empty()) {
+            continue;
+        }
+
+        auto result = setOne(arg);
+        if (!result) {
+            return result;
+        }
+        if (!result->empty()) {
+            if (!shown.empty()) {
+                shown += "  ";
+            }
+            shown += *result;
+        }
+    }
+    return shown;
+}
+
+void Options::onChange(std::string_view name, std::function<void()> callback) {
+    const Spec* spec = find(name);
+    if (!spec) {
+        return;
+    }
+    callbacks.resize(std::size(specs));
+    callbacks[spec - specs] = std::move(callback);
+}
+
+std::expected<std::string, std::string> Options::setOne(std::string_view arg) {
+    size_t equals = arg.find('=');
+    std::string_view name = arg.substr(0, equals);
+    std::string_view value = equals == std::string_view::npos ? "" : arg.substr(equals + 1);
+    char suffix = 0;
+    if (equals == std::string_view::npos && (arg.ends_with('!') || arg.ends_with('?'))) {
+        suffix = arg.back();
+        name.remove_suffix(1);
+    }
+
+    const Spec* spec = find(name);
+    bool negated = false;
+    if (!spec && name.starts_with("no")) {
+        spec = find(name.substr(2));
+        if (spec && spec->kind != Kind::BOOL) {
+            spec = nullptr;
+        }
+        negated = true;
+    }
+    if (!spec) {
+        return std::unexpected(std::format("Unknown option: {}", name));
+    }
+
+    // A bare name shows anything that isn't on/off, like vim
+    if (suffix == '?' || (spec->kind != Kind::BOOL && equals == std::string_view::npos && !suffix)) {
+        return show(*this, *spec);
+    }
+
+    bool changed = false;
+    switch (spec->kind) {
+        case Kind::BOOL: {
+            if (equals != std::string_view::npos || (negated && suffix)) {
+                return std::unexpected(std::format("Invalid argument: {}", arg));
+            }
+            bool& flag = this->*spec->flag;
+            bool next = suffix == '!' ? !flag : !negated;
+            changed = flag != next;
+            flag = next;
+            break;
+        }
+        case Kind::INT: {
+            int next;
+            auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), next);
+            if (equals == std::string_view::npos || value.empty() || error != std::errc()
+                    || end != value.data() + value.size() || next < spec->min) {
+                return std::unexpected(std::format("Invalid argument: {}", arg));
+            }
+            int& number = this->*spec->number;
+            changed = number != next;
+            number = next;
+            break;
+        }
+        case Kind::STRING: {
+            if (equals == std::string_view::npos) {
+                return std::unexpected(std::format("Invalid argument: {}", arg));
+            }
+            std::string& text = this->*spec->text;
+            changed = text != value;
+            text = value;
+            break;
+        }
+    }
+
+    size_t index = spec - specs;
+    if (changed && index < callbacks.size() && callbacks[index]) {
+        callbacks[index]();
+    }
+    return "";
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <expected>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Settings changed with :set and .mirtrc. Code reads them as plain fields.
+// Changes go through set(), which finds each option's name, alias, type and
+// limits in a table in options.cpp and runs its change callback.
+class Options {
+public:
+    bool number = false;
+    bool relativeNumber = false;
+    // Send every cell each frame rather than what changed
+    bool fullRedraw = false;
+    int tabStop = 8;
+    // Milliseconds to wait for the rest of an escape sequence
+    int escTimeout = 20;
+    int maxFps = 60;
+    // KiB of undo history to keep
+    int undoMemory = 32 << 10;
+    // Keep undo history in a file next to the file on save
+    bool undoFile = true;
+    // Log edits to a swap file next to the file, for mirt -r after a crash
+    bool swapFile = true;
+    // Highlight matches of the last search
+    bool hlSearch = true;
+    // Where to write perf's histograms on exit, if anywhere
+    std::string perfFile;
+
+    // Apply space separated :set arguments, each one "name", "noname",
+    // "name!" to toggle, "name?" to show or "name=value". Returns what was
+    // asked for by queries, or why an argument was rejected. Arguments
+    // before a rejected one still apply
+    std::expected<std::string, std::string> set(std::string_view args);
+
+    // Call `callback` after option `name` changes value
+    void onChange(std::string_view name, std::function<void()> callback);
+
+private:
+    // Per option, in table order
+    std::vector<std::function<void()>> callbacks;
+
+    std::expected<std::string, std::string> setOne(std::string_view arg);
+};
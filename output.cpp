@@ -0,0 +1,39 @@
+#include <algorithm>
+#include "output.h"
+
+Output::Output(Terminal& terminal) :
+    maxPending{0},
+    stalls{0},
+    terminal{terminal},
+    sent{0}
+{}
+
+size_t Output::pending() const {
+    return queue.size() - sent;
+}
+
+void Output::write(std::string_view bytes) {
+    queue += bytes;
+    maxPending = std::max(maxPending, pending());
+    flush();
+}
+
+bool Output::flush() {
+    while (pending() > 0) {
+        size_t n = terminal.write(queue.data() + sent, pending());
+        if (n == 0) {
+            ++stalls;
+            return false;
+        }
+        sent += n;
+    }
+    queue.clear();
+    sent = 0;
+    return true;
+}
+
+void Output::drain() {
+    while (!flush()) {
+        terminal.wait(-1, true);
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include "terminal.h"
+
+// Bytes on their way to the terminal. Writes never block: whatever the
+// terminal won't take yet stays queued and goes out as it drains, so a slow
+// link holds up drawing rather than input.
+class Output {
+public:
+    explicit Output(Terminal& terminal);
+
+    // Queue `bytes` and send what can be sent right away
+    void write(std::string_view bytes);
+
+    // Send as much of the queue as the terminal takes. Returns false if some
+    // is left
+    bool flush();
+
+    // Bytes still queued
+    size_t pending() const;
+
+    // Wait until everything queued is sent
+    void drain();
+
+    // Most bytes ever queued at once
+    size_t maxPending;
+    // Writes the terminal only took part of, or none
+    size_t stalls;
+
+private:
+    Terminal& terminal;
+    std::string queue;
+    // Bytes of `queue` already sent
+    size_t sent;
+};
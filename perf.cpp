@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <new>
+#include "perf.h"
+
+// Counted per thread, so background work doesn't show up in frames
+static thread_local uint64_t allocations = 0;
+
+void* operator new(size_t size) {
+    ++allocations;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+uint64_t allocationCount() {
+    return allocations;
+}
+
+Histogram::Histogram() : counts{}, total{0}, largest{0} {}
+
+size_t Histogram::bucketOf(uint64_t value) {
+    if (value < 4) {
+        return value;
+    }
+    int log = 63 - __builtin_clzll(value);
+    // The two bits below the top one pick the quarter
+    return (log - 1) * 4 + ((value >> (log - 2)) & 3);
+}
+
+uint64_t Histogram::lowerBound(size_t bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+    int log = bucket / 4 + 1;
+    return (4 + bucket % 4) << (log - 2);
+}
+
+void Histogram::add(uint64_t value) {
+    ++counts[bucketOf(value)];
+    ++total;
+    largest = std::max(largest, value);
+}
+
+uint64_t Histogram::count() const {
+    return total;
+}
+
+uint64_t Histogram::max() const {
+    return largest;
+}
+
+uint64_t Histogram::percentile(double p) const {
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = std::min<uint64_t>(total - 1, p * total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen > rank) {
+            return lowerBound(i);
+        }
+    }
+    return largest;
+}
+
+std::string Histogram::buckets() const {
+    std::string out;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        if (counts[i]) {
+            out += std::format("  {:>12}: {}\n", lowerBound(i), counts[i]);
+        }
+    }
+    return out;
+}
+
+static const char* const STAGE_NAMES[Perf::STAGES] = {
+    "decode",
+    "dispatch",
+    "scroll",
+    "drawRows",
+    "write"
+};
+
+void Perf::record(Stage stage, Clock::time_point start) {
+    stages[stage].add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+// Short enough for the summary to fit on the message bar
+static const char* const STAGE_LABELS[Perf::STAGES] = {
+    "key",
+    "cmd",
+    "scroll",
+    "rows",
+    "write"
+};
+
+std::string Perf::summary() const {
+    std::string out = "p50/p99 us";
+    for (int i = 0; i < STAGES; ++i) {
+        out += std::format(" {} {:.1f}/{:.1f}", STAGE_LABELS[i],
+            stages[i].percentile(0.5) / 1000.0, stages[i].percentile(0.99) / 1000.0);
+    }
+    out += std::format("; frame {}/{} B {}/{} allocs",
+        frameBytes.percentile(0.5), frameBytes.percentile(0.99),
+        frameAllocations.percentile(0.5), frameAllocations.percentile(0.99));
+    return out;
+}
+
+bool Perf::dump(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+    auto section = [&](const std::string& name, const Histogram& histogram) {
+        file << std::format("{}: count {} p50 {} p90 {} p99 {} max {}\n", name, histogram.count(),
+            histogram.percentile(0.5), histogram.percentile(0.9), histogram.percentile(0.99), histogram.max());
+        file << histogram.buckets();
+    };
+    for (int i = 0; i < STAGES; ++i) {
+        section(std::format("{} ns", STAGE_NAMES[i]), stages[i]);
+    }
+    section("frame bytes", frameBytes);
+    section("frame allocations", frameAllocations);
+    return bool(file);
+}
+
+StageTimer::StageTimer(Perf& perf, Perf::Stage stage) :
+    perf{perf},
+    stage{stage},
+    start{Perf::Clock::now()},
+    cancelled{false}
+{}
+
+StageTimer::~StageTimer() {
+    if (!cancelled) {
+        perf.record(stage, start);
+    }
+}
+
+void StageTimer::cancel() {
+    cancelled = true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Counts of values in fixed buckets: four per power of two, so percentiles
+// are within about 20% and adding a value is a few instructions.
+class Histogram {
+public:
+    Histogram();
+
+    void add(uint64_t value);
+
+    uint64_t count() const;
+    uint64_t max() const;
+    // Lower bound of the bucket holding the p-th value, 0 <= p <= 1
+    uint64_t percentile(double p) const;
+
+    // Every nonempty bucket as "lower: count" lines
+    std::string buckets() const;
+
+private:
+    static constexpr size_t BUCKETS = 252;
+
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+    uint64_t largest;
+
+    static size_t bucketOf(uint64_t value);
+    static uint64_t lowerBound(size_t bucket);
+};
+
+// Always-on timers for the stages between a key coming in and its frame
+// going out, plus what each frame costs.
+class Perf {
+public:
+    enum Stage {
+        DECODE,
+        DISPATCH,
+        SCROLL,
+        DRAW_ROWS,
+        WRITE,
+        STAGES
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    // Nanoseconds per stage
+    Histogram stages[STAGES];
+    Histogram frameBytes;
+    Histogram frameAllocations;
+
+    void record(Stage stage, Clock::time_point start);
+
+    // One line for the message bar
+    std::string summary() const;
+
+    // Write everything, buckets included, to `path`. Returns false if it
+    // can't be written
+    bool dump(const std::string& path) const;
+};
+
+// Records the time until it goes out of scope, unless cancelled
+class StageTimer {
+public:
+    StageTimer(Perf& perf, Perf::Stage stage);
+    ~StageTimer();
+    void cancel();
+
+private:
+    Perf& perf;
+    Perf::Stage stage;
+    Perf::Clock::time_point start;
+    bool cancelled;
+};
+
+// Heap allocations made by the calling thread so far
+uint64_t allocationCount();
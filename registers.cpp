@@ -0,0 +1,45 @@
+#include <cctype>
+#include "registers.h"
+
+bool Registers::valid(char name) {
+    return name == '"' || std::isdigit((unsigned char)name) || std::isalpha((unsigned char)name);
+}
+
+void Registers::yank(char name, const Register& reg) {
+    store(name ? name : '0', reg);
+}
+
+void Registers::remove(char name, const Register& reg) {
+    if (name) {
+        store(name, reg);
+        return;
+    }
+    // Older deletes move down a register, the oldest falling off "9
+    for (int slot = slotOf('9'); slot > slotOf('1'); --slot) {
+        slots[slot] = slots[slot - 1];
+        used[slot] = used[slot - 1];
+    }
+    store('1', reg);
+}
+
+const Registers::Register* Registers::get(char name) const {
+    int slot = slotOf(name);
+    return used[slot] ? &slots[slot] : nullptr;
+}
+
+int Registers::slotOf(char name) {
+    if (std::isdigit((unsigned char)name)) {
+        return 1 + (name - '0');
+    }
+    if (std::isalpha((unsigned char)name)) {
+        return 11 + (std::tolower((unsigned char)name) - 'a');
+    }
+    return 0;
+}
+
+void Registers::store(char name, const Register& reg) {
+    slots[slotOf(name)] = reg;
+    used[slotOf(name)] = true;
+    slots[0] = reg;
+    used[0] = true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "buffer.h"
+
+// Text yanked or deleted, for p and P to put back. Held as buffer snapshots
+// rather than copies, so yanking a whole file costs a few tree nodes.
+//
+// Like vim: yanks go to "0 and deletes shift through "1 to "9 unless a
+// register is named, and the unnamed register always has the latest.
+class Registers {
+public:
+    struct Register {
+        Buffer::Snapshot text;
+        // Whole lines, put above or below the cursor's line
+        bool linewise = false;
+    };
+
+    // Whether `name` can follow " to pick a register
+    static bool valid(char name);
+
+    // Store a yank or delete. `name` is 0 if none was given
+    void yank(char name, const Register& reg);
+    void remove(char name, const Register& reg);
+
+    // Contents of `name`, or the unnamed register if 0. Null if never set
+    const Register* get(char name) const;
+
+private:
+    // The unnamed register, then "0 to "9, then "a to "z
+    static constexpr int SLOTS = 1 + 10 + 26;
+
+    Register slots[SLOTS];
+    bool used[SLOTS] = {};
+
+    static int slotOf(char name);
+    void store(char name, const Register& reg);
+};
@@ -0,0 +1,50 @@
+#include <algorithm>
+#include "rendercache.h"
+#include "utils.h"
+
+RenderCache::RenderCache() : generation{0}, tabStop{8} {
+    resize(1);
+}
+
+void RenderCache::resize(size_t capacity) {
+    entries.assign(std::max<size_t>(1, capacity), Entry{false, 0, 0, ""});
+}
+
+const std::string& RenderCache::get(const Buffer& buffer, size_t line) {
+    // Consecutive rows land in distinct slots
+    Entry& entry = entries[line % entries.size()];
+    if (!entry.valid || entry.line != line || entry.generation != generation) {
+        entry.text = buffer.line(line);
+        if (entry.text.find('\t') != std::string::npos) {
+            entry.text = parseLine(entry.text, tabStop);
+        }
+        entry.valid = true;
+        entry.line = line;
+        entry.generation = generation;
+    }
+    return entry.text;
+}
+
+void RenderCache::invalidate(size_t line) {
+    Entry& entry = entries[line % entries.size()];
+    if (entry.line == line) {
+        entry.valid = false;
+    }
+}
+
+void RenderCache::invalidateFrom(size_t line) {
+    for (Entry& entry : entries) {
+        if (entry.line >= line) {
+            entry.valid = false;
+        }
+    }
+}
+
+void RenderCache::bumpGeneration() {
+    ++generation;
+}
+
+void RenderCache::setTabStop(int tabStop) {
+    this->tabStop = tabStop;
+    bumpGeneration();
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "buffer.h"
+
+// Rendered (tab expanded) text for the rows being drawn. Entries are built the
+// first time a row is drawn and dropped per line on edit, while bumping the
+// generation makes every entry stale at once. A line without tabs is kept as
+// is, since it renders to itself.
+class RenderCache {
+public:
+    RenderCache();
+
+    // Number of rows kept, normally the screen height
+    void resize(size_t capacity);
+
+    // Rendered text of `line`, built from `buffer` if not cached
+    const std::string& get(const Buffer& buffer, size_t line);
+
+    void invalidate(size_t line);
+
+    // Drop `line` and everything after it, for when lines shift
+    void invalidateFrom(size_t line);
+
+    // Make every entry stale
+    void bumpGeneration();
+
+    // Expand tabs to every `tabStop` columns from now on
+    void setTabStop(int tabStop);
+
+private:
+    struct Entry {
+        bool valid;
+        size_t line;
+        uint64_t generation;
+        std::string text;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t generation;
+    int tabStop;
+};
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <format>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+#include "save.h"
+#include "utils.h"
+
+// Write all of `iov`, picking up after short writes. Returns false with errno
+// set on failure
+static bool writeAll(int fd, struct iovec* iov, int count, size_t& written) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        written += n;
+        // Skip what went out
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+static std::unexpected<std::string> fail(const std::string& what, const std::string& temp, int fd) {
+    int err = errno;
+    if (fd != -1) {
+        close(fd);
+    }
+    if (!temp.empty()) {
+        unlink(temp.c_str());
+    }
+    return std::unexpected(std::format("{}: {}", what, strerror(err)));
+}
+
+// Most bytes handed to one writev, so progress keeps moving through a file
+// that is one huge piece
+static constexpr size_t BATCH_BYTES = 8 << 20;
+
+std::expected<size_t, std::string> writeAtomically(
+    const std::string& path,
+    const Buffer::Snapshot& snapshot,
+    std::atomic<size_t>* progress
+) {
+    // Save through symlinks rather than over them
+    std::string target = path;
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved)) {
+        target = resolved;
+    }
+
+    size_t slash = target.rfind('/');
+    std::string dir = slash == std::string::npos ? "./" : target.substr(0, slash + 1);
+    std::string base = slash == std::string::npos ? target : target.substr(slash + 1);
+    std::string temp = std::format("{}.{}.XXXXXX", dir, base);
+
+    int fd = mkstemp(temp.data());
+    if (fd == -1) {
+        return fail("Can't create temp file", "", -1);
+    }
+
+    struct stat st;
+    if (stat(target.c_str(), &st) == 0) {
+        if (fchmod(fd, st.st_mode & 07777) == -1) {
+            return fail("Can't copy permissions", temp, fd);
+        }
+        // Only works for root or when nothing changes; not worth failing over
+        if (fchown(fd, st.st_uid, st.st_gid) == -1) {}
+    }
+    else {
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(fd, 0644 & ~mask);
+    }
+
+    // Stream the pieces straight out of the snapshot, a batch at a time
+    std::vector<struct iovec> iov;
+    iov.reserve(IOV_MAX);
+    size_t written = 0;
+    Buffer::Spans spans = snapshot.spans();
+    std::string_view span;
+    bool more = true;
+    while (more) {
+        iov.clear();
+        size_t batch = 0;
+        while (iov.size() < IOV_MAX && batch < BATCH_BYTES && (!span.empty() || (more = spans.next(span)))) {
+            size_t take = std::min(span.size(), BATCH_BYTES - batch);
+            iov.push_back({const_cast<char*>(span.data()), take});
+            span.remove_prefix(take);
+            batch += take;
+        }
+        if (!writeAll(fd, iov.data(), iov.size(), written)) {
+            return fail(std::format("Write failed after {} of {} bytes", written, snapshot.size()), temp, fd);
+        }
+        if (progress) {
+            progress->store(written, std::memory_order_relaxed);
+            wakeMainLoop();
+        }
+    }
+
+    if (fsync(fd) == -1) {
+        return fail("fsync failed", temp, fd);
+    }
+    if (close(fd) == -1) {
+        return fail("close failed", temp, -1);
+    }
+    if (rename(temp.c_str(), target.c_str()) == -1) {
+        return fail("rename failed", temp, -1);
+    }
+
+    // Make the rename itself durable
+    int dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd != -1) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+    return written;
+}
+
+BackgroundSave::BackgroundSave() : textHash{0}, written{0}, done{false} {}
+
+BackgroundSave::~BackgroundSave() {
+    if (writer.joinable()) {
+        writer.join();
+    }
+}
+
+void BackgroundSave::start(const std::string& path, Buffer::Snapshot snapshot) {
+    this->snapshot = std::move(snapshot);
+    written = 0;
+    done = false;
+    writer = std::thread([this, path] {
+        result = writeAtomically(path, this->snapshot, &written);
+        if (result) {
+            // For the undo file, while we're off the main thread anyway
+            textHash = this->snapshot.hash();
+        }
+        done.store(true, std::memory_order_release);
+        wakeMainLoop();
+    });
+}
+
+bool BackgroundSave::active() const {
+    return writer.joinable();
+}
+
+bool BackgroundSave::finished() const {
+    return done.load(std::memory_order_acquire);
+}
+
+int BackgroundSave::progress() const {
+    size_t total = snapshot.size();
+    if (total == 0) {
+        return 100;
+    }
+    return written.load(std::memory_order_relaxed) * 100 / total;
+}
+
+std::expected<size_t, std::string> BackgroundSave::collect() {
+    writer.join();
+    // Let go of the snapshot here rather than on the writer, so the buffer
+    // sees its nodes unshared only once nothing reads them
+    snapshot = Buffer::Snapshot();
+    return result;
+}
+
+uint64_t BackgroundSave::hash() const {
+    return textHash;
+}
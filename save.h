@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <expected>
+#include <string>
+#include <thread>
+#include "buffer.h"
+
+// Write `buffer` to `path` by streaming it into a temporary file in the same
+// directory, fsyncing that and renaming it over `path`. A crash leaves either
+// the old file or the new one, never a truncated mix. The old file's
+// permissions are kept. Bytes written so far are published to `progress` as
+// the write goes. Returns the number of bytes written
+std::expected<size_t, std::string> writeAtomically(
+    const std::string& path,
+    const Buffer::Snapshot& snapshot,
+    std::atomic<size_t>* progress = nullptr
+);
+
+// Runs writeAtomically on a thread of its own so a big save doesn't hold up
+// editing. One save at a time
+class BackgroundSave {
+public:
+    BackgroundSave();
+    ~BackgroundSave();
+    BackgroundSave(const BackgroundSave&) = delete;
+    BackgroundSave& operator=(const BackgroundSave&) = delete;
+
+    void start(const std::string& path, Buffer::Snapshot snapshot);
+
+    // Started and not yet collected
+    bool active() const;
+    // The writer is done and collect() won't wait
+    bool finished() const;
+
+    // Percentage of the snapshot written so far
+    int progress() const;
+
+    // Wait for the writer and return what writeAtomically did
+    std::expected<size_t, std::string> collect();
+
+    // Snapshot::hash() of what the last collected save wrote
+    uint64_t hash() const;
+
+private:
+    std::thread writer;
+    // Only touched by the writer until it sets `done`
+    Buffer::Snapshot snapshot;
+    std::expected<size_t, std::string> result;
+    uint64_t textHash;
+    std::atomic<size_t> written;
+    std::atomic<bool> done;
+};
@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <cstdlib>
+#include "screen.h"
+
+// Unchanged cells shorter than this between two changes are sent again
+// rather than jumped over, since the jump costs about as much
+static constexpr int MAX_GAP = 6;
+
+static constexpr char BLANK = ' ';
+
+Screen::Screen() :
+    nrows{0},
+    ncols{0},
+    frontValid{false},
+    termRow{-1},
+    termCol{-1},
+    termAttr{-1}
+{}
+
+void Screen::resize(int rows, int cols) {
+    nrows = std::max(0, rows);
+    ncols = std::max(0, cols);
+    back.assign(nrows * ncols, Cell{BLANK, NORMAL});
+    front = back;
+    invalidate();
+}
+
+int Screen::rows() const {
+    return nrows;
+}
+
+int Screen::cols() const {
+    return ncols;
+}
+
+void Screen::clear() {
+    std::fill(back.begin(), back.end(), Cell{BLANK, NORMAL});
+}
+
+int Screen::put(int row, int col, std::string_view text, uint8_t attr) {
+    if (row < 0 || row >= nrows || col >= ncols) {
+        return col;
+    }
+    Cell* cells = &back[row * ncols];
+    for (char c : text) {
+        if (col >= ncols) {
+            break;
+        }
+        if (col >= 0) {
+            cells[col] = Cell{c, attr};
+        }
+        ++col;
+    }
+    return col;
+}
+
+void Screen::scroll(int top, int bottom, int count) {
+    top = std::max(0, top);
+    bottom = std::min(nrows, bottom);
+    int height = bottom - top;
+    // Redrawing everything anyway, or nothing would be kept
+    if (!frontValid || count == 0 || std::abs(count) >= height) {
+        return;
+    }
+
+    auto first = front.begin() + top * ncols;
+    auto last = front.begin() + bottom * ncols;
+    if (count > 0) {
+        std::move(first + count * ncols, last, first);
+        std::fill(last - count * ncols, last, Cell{BLANK, NORMAL});
+    }
+    else {
+        std::move_backward(first, last + count * ncols, last);
+        std::fill(first, first - count * ncols, Cell{BLANK, NORMAL});
+    }
+
+    // Rows scrolled in take the current attributes
+    setAttr(pending, NORMAL);
+    pending.append("\x1b[");
+    pending.appendNumber(top + 1);
+    pending.append(';');
+    pending.appendNumber(bottom);
+    pending.append('r');
+    pending.appendCsi(std::abs(count), count > 0 ? 'S' : 'T');
+    pending.append("\x1b[r");
+    // Setting the region homes the cursor
+    termRow = 0;
+    termCol = 0;
+}
+
+void Screen::invalidate() {
+    frontValid = false;
+    pending.clear();
+    termRow = termCol = termAttr = -1;
+}
+
+bool Screen::hasMultibyte(const Cell* cells) const {
+    return std::any_of(cells, cells + ncols, [](const Cell& cell) {
+        return static_cast<unsigned char>(cell.ch) >= 0x80;
+    });
+}
+
+void Screen::moveTo(AppendBuffer& out, int row, int col) {
+    if (row == termRow && col == termCol) {
+        return;
+    }
+    if (row == termRow && col == 0) {
+        out.append('\r');
+    }
+    else if (row == termRow + 1 && col == 0 && termCol != -1) {
+        out.append("\r\n");
+    }
+    else {
+        out.appendCursorPosition(row, col);
+    }
+    termRow = row;
+    termCol = col;
+}
+
+void Screen::setAttr(AppendBuffer& out, uint8_t attr) {
+    if (attr == termAttr) {
+        return;
+    }
+    out.append("\x1b[0");
+    if (attr & DIM) {
+        out.append(";2");
+    }
+    if (attr & INVERSE) {
+        out.append(";7");
+    }
+    if (attr & HIGHLIGHT) {
+        out.append(";30;43");
+    }
+    out.append('m');
+    termAttr = attr;
+}
+
+void Screen::flush(AppendBuffer& out, int cursorRow, int cursorCol, bool full) {
+    full = full || !frontValid;
+    size_t start = out.size();
+    out.append("\x1b[?25l");
+    size_t hidden = out.size();
+    out.append(pending.view());
+    pending.clear();
+
+    const Cell blank{BLANK, NORMAL};
+    for (int row = 0; row < nrows; ++row) {
+        const Cell* cells = &back[row * ncols];
+        const Cell* shown = &front[row * ncols];
+        // A change can't be placed by column on a row with multi-byte
+        // characters, so the whole row goes again
+        bool multibyte = hasMultibyte(cells) || hasMultibyte(shown);
+        auto differs = [&](int col) { return full || multibyte || cells[col] != shown[col]; };
+
+        // Past `end` the row is blank and can be cleared in one go
+        int end = ncols;
+        while (end > 0 && cells[end - 1] == blank) {
+            --end;
+        }
+
+        int col = 0;
+        while (col < ncols) {
+            if (!differs(col)) {
+                ++col;
+                continue;
+            }
+            if (col >= end) {
+                moveTo(out, row, col);
+                setAttr(out, NORMAL);
+                out.append("\x1b[K");
+                break;
+            }
+
+            moveTo(out, row, col);
+            while (col < end) {
+                setAttr(out, cells[col].attr);
+                out.append(cells[col].ch);
+                ++col;
+                // Carry on through short runs of unchanged cells
+                int next = col;
+                while (next < end && next - col < MAX_GAP && !differs(next)) {
+                    ++next;
+                }
+                if (next == end || next - col == MAX_GAP) {
+                    break;
+                }
+            }
+            // The cursor doesn't move past the last column
+            termCol = col < ncols ? col : -1;
+        }
+        if (multibyte && termRow == row) {
+            // Written in one run, but where it ended up is in columns
+            termCol = -1;
+        }
+    }
+
+    if (out.size() == hidden) {
+        // Nothing changed, so no need to hide the cursor
+        out.truncate(start);
+        moveTo(out, cursorRow, cursorCol);
+    }
+    else {
+        setAttr(out, NORMAL);
+        moveTo(out, cursorRow, cursorCol);
+        out.append("\x1b[?25h");
+    }
+    front = back;
+    frontValid = true;
+}
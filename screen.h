@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "appendbuffer.h"
+
+// What the terminal shows, as a grid of cells. A frame is drawn into the back
+// grid, and flush() sends only the cells that differ from the frame before,
+// so moving the cursor or typing a character costs a few bytes instead of a
+// whole screen.
+class Screen {
+public:
+    enum Attr : uint8_t {
+        NORMAL = 0,
+        DIM = 1 << 0,
+        INVERSE = 1 << 1,
+        // Search matches, black on yellow
+        HIGHLIGHT = 1 << 2
+    };
+
+    Screen();
+
+    void resize(int rows, int cols);
+    int rows() const;
+    int cols() const;
+
+    // Blank the back grid for a new frame
+    void clear();
+
+    // Write `text` at row, col, clipped to the row. Returns the column after it
+    int put(int row, int col, std::string_view text, uint8_t attr = NORMAL);
+
+    // Append the escapes that turn the last frame into this one to `out`,
+    // leaving the cursor at cursorRow, cursorCol. `full` redraws every cell
+    void flush(AppendBuffer& out, int cursorRow, int cursorCol, bool full);
+
+    // Move rows [top, bottom) of what the terminal shows up by `count` lines,
+    // or down if `count` is negative. Sent ahead of the next flush through a
+    // scroll region, so rows that only moved aren't sent again
+    void scroll(int top, int bottom, int count);
+
+    // Forget what the terminal shows, e.g. after something else wrote to it
+    void invalidate();
+
+private:
+    struct Cell {
+        char ch;
+        uint8_t attr;
+
+        bool operator==(const Cell& other) const = default;
+    };
+
+    int nrows;
+    int ncols;
+    std::vector<Cell> back;
+    std::vector<Cell> front;
+    bool frontValid;
+    // Escapes to send ahead of the next frame
+    AppendBuffer pending;
+
+    // Where the terminal's cursor is and which attributes are set, as of
+    // the last thing flushed. -1 for unknown
+    int termRow;
+    int termCol;
+    int termAttr;
+
+    // Whether the row at `cells` holds a byte of a multi-byte character.
+    // Cells are bytes, so past one of those the terminal's columns aren't
+    // the cells'
+    bool hasMultibyte(const Cell* cells) const;
+    void moveTo(AppendBuffer& out, int row, int col);
+    void setAttr(AppendBuffer& out, uint8_t attr);
+};
@@ -0,0 +1,506 @@
+#include <algorithm>
+#include <string.h>
+#include "simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MIRT_X86 1
+#endif
+
+struct Kernels {
+    size_t (*countByte)(const char* src, size_t len, char byte);
+    void (*findAll)(const char* src, size_t len, char byte, uint32_t base, std::vector<uint32_t>& out);
+    // Writes to `dst`, which has room for the expanded text. Returns the end
+    // of what was written
+    char* (*expandTabs)(const char* src, size_t len, int tabStop, char* dst);
+    // Sets bit i of the masks if byte i is a keyword character or a blank.
+    // The masks have room for (len + 63) / 64 words
+    void (*classify)(const char* src, size_t len, uint64_t* keyword, uint64_t* blank);
+    // First and last offset of the `n` byte needle, or npos. 1 <= n <= len
+    size_t (*find)(const char* src, size_t len, const char* needle, size_t n);
+    size_t (*findLast)(const char* src, size_t len, const char* needle, size_t n);
+};
+
+static constexpr size_t NPOS = std::string_view::npos;
+
+// Scalar loops, also used for the tails of the vector kernels. Inlined so
+// they take on the caller's instruction set
+__attribute__((always_inline))
+static inline size_t countByteTail(const char* src, size_t len, char byte) {
+    size_t count = 0;
+    for (size_t i = 0; i < len; ++i) {
+        count += src[i] == byte;
+    }
+    return count;
+}
+
+__attribute__((always_inline))
+static inline void findAllTail(const char* src, size_t len, char byte, uint32_t base, std::vector<uint32_t>& out) {
+    for (size_t i = 0; i < len; ++i) {
+        if (src[i] == byte) {
+            out.push_back(base + i);
+        }
+    }
+}
+
+// Copy the run before the tab at `tab`, then the tab's spaces
+__attribute__((always_inline))
+static inline char* emitTab(const char* src, size_t& runStart, size_t tab, int tabStop, char* dst) {
+    memcpy(dst, src + runStart, tab - runStart);
+    dst += tab - runStart;
+    memset(dst, ' ', tabStop);
+    runStart = tab + 1;
+    return dst + tabStop;
+}
+
+__attribute__((always_inline))
+static inline char* expandTabsTail(const char* src, size_t from, size_t len, size_t runStart, int tabStop, char* dst) {
+    for (size_t i = from; i < len; ++i) {
+        if (src[i] == '\t') {
+            dst = emitTab(src, runStart, i, tabStop, dst);
+        }
+    }
+    memcpy(dst, src + runStart, len - runStart);
+    return dst + len - runStart;
+}
+
+__attribute__((always_inline))
+static inline bool isKeywordByte(unsigned char c) {
+    return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || c == '_';
+}
+
+__attribute__((always_inline))
+static inline bool isBlankByte(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+__attribute__((always_inline))
+static inline void classifyTail(const char* src, size_t from, size_t len, uint64_t* keyword, uint64_t* blank) {
+    for (size_t i = from; i < len; ++i) {
+        uint64_t bit = uint64_t(1) << (i % 64);
+        if (i % 64 == 0) {
+            keyword[i / 64] = 0;
+            blank[i / 64] = 0;
+        }
+        if (isKeywordByte(src[i])) {
+            keyword[i / 64] |= bit;
+        }
+        else if (isBlankByte(src[i])) {
+            blank[i / 64] |= bit;
+        }
+    }
+}
+
+// Whether the needle is at `at`, its first and last bytes being known to match
+__attribute__((always_inline))
+static inline bool middleMatches(const char* at, const char* needle, size_t n) {
+    return n <= 2 || memcmp(at + 1, needle + 1, n - 2) == 0;
+}
+
+__attribute__((always_inline))
+static inline bool matchesAt(const char* at, const char* needle, size_t n) {
+    return at[0] == needle[0] && at[n - 1] == needle[n - 1] && middleMatches(at, needle, n);
+}
+
+// Starts from `from` to the end
+__attribute__((always_inline))
+static inline size_t findTail(const char* src, size_t from, size_t len, const char* needle, size_t n) {
+    for (size_t i = from; i + n <= len; ++i) {
+        if (matchesAt(src + i, needle, n)) {
+            return i;
+        }
+    }
+    return NPOS;
+}
+
+// Starts before `end`, last first
+__attribute__((always_inline))
+static inline size_t findLastTail(const char* src, size_t end, const char* needle, size_t n) {
+    for (size_t i = end; i-- > 0;) {
+        if (matchesAt(src + i, needle, n)) {
+            return i;
+        }
+    }
+    return NPOS;
+}
+
+static size_t countByteScalar(const char* src, size_t len, char byte) {
+    return countByteTail(src, len, byte);
+}
+
+static void findAllScalar(const char* src, size_t len, char byte, uint32_t base, std::vector<uint32_t>& out) {
+    findAllTail(src, len, byte, base, out);
+}
+
+static char* expandTabsScalar(const char* src, size_t len, int tabStop, char* dst) {
+    return expandTabsTail(src, 0, len, 0, tabStop, dst);
+}
+
+static void classifyScalar(const char* src, size_t len, uint64_t* keyword, uint64_t* blank) {
+    classifyTail(src, 0, len, keyword, blank);
+}
+
+static size_t findScalar(const char* src, size_t len, const char* needle, size_t n) {
+    return findTail(src, 0, len, needle, n);
+}
+
+static size_t findLastScalar(const char* src, size_t len, const char* needle, size_t n) {
+    return findLastTail(src, len - n + 1, needle, n);
+}
+
+#ifdef MIRT_X86
+static size_t countByteSse2(const char* src, size_t len, char byte) {
+    const __m128i needle = _mm_set1_epi8(byte);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)));
+    }
+    return count + countByteTail(src + i, len - i, byte);
+}
+
+static void findAllSse2(const char* src, size_t len, char byte, uint32_t base, std::vector<uint32_t>& out) {
+    const __m128i needle = _mm_set1_epi8(byte);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        while (mask) {
+            out.push_back(base + i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    findAllTail(src + i, len - i, byte, base + i, out);
+}
+
+static char* expandTabsSse2(const char* src, size_t len, int tabStop, char* dst) {
+    const __m128i tab = _mm_set1_epi8('\t');
+    size_t runStart = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, tab));
+        while (mask) {
+            dst = emitTab(src, runStart, i + __builtin_ctz(mask), tabStop, dst);
+            mask &= mask - 1;
+        }
+    }
+    return expandTabsTail(src, i, len, runStart, tabStop, dst);
+}
+
+// Bytes of `block` in [lo, lo + span]
+__attribute__((always_inline))
+static inline __m128i inRangeSse2(__m128i block, char lo, char span) {
+    __m128i offset = _mm_sub_epi8(block, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(span)), offset);
+}
+
+static void classifySse2(const char* src, size_t len, uint64_t* keyword, uint64_t* blank) {
+    // Short rows are common, so the tail goes through a zero padded block
+    // rather than a byte at a time. Zero is neither keyword nor blank
+    char padded[64];
+    for (size_t i = 0; i < len; i += 64) {
+        const char* block64 = src + i;
+        if (i + 64 > len) {
+            memset(padded, 0, sizeof(padded));
+            memcpy(padded, src + i, len - i);
+            block64 = padded;
+        }
+        uint64_t keywords = 0;
+        uint64_t blanks = 0;
+        for (int part = 0; part < 4; ++part) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block64 + part * 16));
+            __m128i letter = inRangeSse2(_mm_or_si128(block, _mm_set1_epi8(0x20)), 'a', 'z' - 'a');
+            __m128i word = _mm_or_si128(_mm_or_si128(letter, inRangeSse2(block, '0', 9)),
+                _mm_cmpeq_epi8(block, _mm_set1_epi8('_')));
+            __m128i space = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')), inRangeSse2(block, '\t', 4));
+            keywords |= uint64_t(_mm_movemask_epi8(word)) << (part * 16);
+            blanks |= uint64_t(_mm_movemask_epi8(space)) << (part * 16);
+        }
+        keyword[i / 64] = keywords;
+        blank[i / 64] = blanks;
+    }
+}
+
+static size_t findSse2(const char* src, size_t len, const char* needle, size_t n) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[n - 1]);
+    size_t i = 0;
+    // 16 starts at a time, while their last bytes are in range
+    for (; i + n - 1 + 16 <= len; i += 16) {
+        __m128i heads = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i tails = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + n - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(heads, first), _mm_cmpeq_epi8(tails, last)));
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+            if (middleMatches(src + at, needle, n)) {
+                return at;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return findTail(src, i, len, needle, n);
+}
+
+static size_t findLastSse2(const char* src, size_t len, const char* needle, size_t n) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[n - 1]);
+    // Starts before `end` are left, taken 16 at a time from the back
+    size_t end = len - n + 1;
+    for (; end >= 16; end -= 16) {
+        size_t i = end - 16;
+        __m128i heads = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i tails = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + n - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(heads, first), _mm_cmpeq_epi8(tails, last)));
+        while (mask) {
+            int bit = 31 - __builtin_clz(mask);
+            if (middleMatches(src + i + bit, needle, n)) {
+                return i + bit;
+            }
+            mask &= ~(1u << bit);
+        }
+    }
+    return findLastTail(src, end, needle, n);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t countByteAvx2(const char* src, size_t len, char byte) {
+    const __m256i needle = _mm256_set1_epi8(byte);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        count += _mm_popcnt_u32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+    }
+    return count + countByteTail(src + i, len - i, byte);
+}
+
+__attribute__((target("avx2,bmi")))
+static void findAllAvx2(const char* src, size_t len, char byte, uint32_t base, std::vector<uint32_t>& out) {
+    const __m256i needle = _mm256_set1_epi8(byte);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+        while (mask) {
+            out.push_back(base + i + _tzcnt_u32(mask));
+            mask = _blsr_u32(mask);
+        }
+    }
+    findAllTail(src + i, len - i, byte, base + i, out);
+}
+
+__attribute__((target("avx2,bmi")))
+static char* expandTabsAvx2(const char* src, size_t len, int tabStop, char* dst) {
+    const __m256i tab = _mm256_set1_epi8('\t');
+    size_t runStart = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, tab));
+        while (mask) {
+            dst = emitTab(src, runStart, i + _tzcnt_u32(mask), tabStop, dst);
+            mask = _blsr_u32(mask);
+        }
+    }
+    return expandTabsTail(src, i, len, runStart, tabStop, dst);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i inRangeAvx2(__m256i block, char lo, char span) {
+    __m256i offset = _mm256_sub_epi8(block, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(span)), offset);
+}
+
+__attribute__((target("avx2")))
+static void classifyAvx2(const char* src, size_t len, uint64_t* keyword, uint64_t* blank) {
+    char padded[64];
+    for (size_t i = 0; i < len; i += 64) {
+        const char* block64 = src + i;
+        if (i + 64 > len) {
+            memset(padded, 0, sizeof(padded));
+            memcpy(padded, src + i, len - i);
+            block64 = padded;
+        }
+        uint64_t keywords = 0;
+        uint64_t blanks = 0;
+        for (int part = 0; part < 2; ++part) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block64 + part * 32));
+            __m256i letter = inRangeAvx2(_mm256_or_si256(block, _mm256_set1_epi8(0x20)), 'a', 'z' - 'a');
+            __m256i word = _mm256_or_si256(_mm256_or_si256(letter, inRangeAvx2(block, '0', 9)),
+                _mm256_cmpeq_epi8(block, _mm256_set1_epi8('_')));
+            __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')), inRangeAvx2(block, '\t', 4));
+            keywords |= uint64_t(uint32_t(_mm256_movemask_epi8(word))) << (part * 32);
+            blanks |= uint64_t(uint32_t(_mm256_movemask_epi8(space))) << (part * 32);
+        }
+        keyword[i / 64] = keywords;
+        blank[i / 64] = blanks;
+    }
+}
+
+__attribute__((target("avx2,bmi")))
+static size_t findAvx2(const char* src, size_t len, const char* needle, size_t n) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[n - 1]);
+    size_t i = 0;
+    for (; i + n - 1 + 32 <= len; i += 32) {
+        __m256i heads = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i tails = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + n - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(heads, first), _mm256_cmpeq_epi8(tails, last)));
+        while (mask) {
+            size_t at = i + _tzcnt_u32(mask);
+            if (middleMatches(src + at, needle, n)) {
+                return at;
+            }
+            mask = _blsr_u32(mask);
+        }
+    }
+    return findTail(src, i, len, needle, n);
+}
+
+__attribute__((target("avx2,bmi")))
+static size_t findLastAvx2(const char* src, size_t len, const char* needle, size_t n) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[n - 1]);
+    size_t end = len - n + 1;
+    for (; end >= 32; end -= 32) {
+        size_t i = end - 32;
+        __m256i heads = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i tails = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + n - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(heads, first), _mm256_cmpeq_epi8(tails, last)));
+        while (mask) {
+            int bit = 31 - __builtin_clz(mask);
+            if (middleMatches(src + i + bit, needle, n)) {
+                return i + bit;
+            }
+            mask &= ~(1u << bit);
+        }
+    }
+    return findLastTail(src, end, needle, n);
+}
+#endif
+
+static Kernels kernelsFor(SimdLevel level) {
+    switch (level) {
+#ifdef MIRT_X86
+        case SimdLevel::AVX2:
+            return {countByteAvx2, findAllAvx2, expandTabsAvx2, classifyAvx2, findAvx2, findLastAvx2};
+        case SimdLevel::SSE2:
+            return {countByteSse2, findAllSse2, expandTabsSse2, classifySse2, findSse2, findLastSse2};
+#endif
+        default:
+            return {countByteScalar, findAllScalar, expandTabsScalar, classifyScalar, findScalar, findLastScalar};
+    }
+}
+
+struct Dispatch {
+    SimdLevel level;
+    Kernels kernels;
+};
+
+static Dispatch& dispatch() {
+    static Dispatch active{detectSimdLevel(), kernelsFor(detectSimdLevel())};
+    return active;
+}
+
+SimdLevel detectSimdLevel() {
+#ifdef MIRT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("popcnt")) {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SimdLevel::SSE2;
+    }
+#endif
+    return SimdLevel::SCALAR;
+}
+
+SimdLevel simdLevel() {
+    return dispatch().level;
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::AVX2: return "avx2";
+        case SimdLevel::SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+void setSimdLevel(SimdLevel level) {
+    level = std::min(level, detectSimdLevel());
+    dispatch() = {level, kernelsFor(level)};
+}
+
+void expandTabs(const char* src, size_t len, int tabStop, std::string& out) {
+    const Kernels& kernels = dispatch().kernels;
+    size_t tabs = kernels.countByte(src, len, '\t');
+    if (tabs == 0) {
+        out.append(src, len);
+        return;
+    }
+
+    // Size the output once, then copy the runs between tabs in bulk
+    size_t pos = out.size();
+    out.resize(pos + len + tabs * (tabStop - 1));
+    kernels.expandTabs(src, len, tabStop, out.data() + pos);
+}
+
+int cxToRx(const char* row, size_t len, size_t cx, int tabStop) {
+    size_t tabs = dispatch().kernels.countByte(row, std::min(cx, len), '\t');
+    return cx + tabs * (tabStop - 1);
+}
+
+void findNewlines(const char* src, size_t len, std::vector<uint32_t>& out) {
+    dispatch().kernels.findAll(src, len, '\n', 0, out);
+}
+
+void wordBoundaries(const char* src, size_t len, std::vector<uint64_t>& starts, std::vector<uint64_t>& ends) {
+    size_t words = (len + 63) / 64;
+    starts.resize(words);
+    ends.resize(words);
+    // Classes go in the output until they're turned into boundaries
+    uint64_t* keyword = starts.data();
+    uint64_t* blank = ends.data();
+    dispatch().kernels.classify(src, len, keyword, blank);
+
+    // A word starts where the class of a non-blank byte differs from the one
+    // before it, and ends where it differs from the one after
+    uint64_t prevKeyword = 0;
+    uint64_t prevOther = 0;
+    uint64_t nextKeyword = words ? keyword[0] : 0;
+    uint64_t nextOther = 0;
+    for (size_t w = 0; w < words; ++w) {
+        uint64_t valid = (w + 1) * 64 <= len ? ~uint64_t(0) : (uint64_t(1) << (len % 64)) - 1;
+        uint64_t keywords = nextKeyword;
+        uint64_t others = ~keywords & ~blank[w] & valid;
+        nextKeyword = w + 1 < words ? keyword[w + 1] : 0;
+        nextOther = w + 1 < words ? ~nextKeyword & ~blank[w + 1] : 0;
+        if (w + 2 == words) {
+            nextOther &= len % 64 ? (uint64_t(1) << (len % 64)) - 1 : ~uint64_t(0);
+        }
+
+        starts[w] = (keywords & ~((keywords << 1) | prevKeyword))
+            | (others & ~((others << 1) | prevOther));
+        ends[w] = (keywords & ~((keywords >> 1) | (nextKeyword << 63)))
+            | (others & ~((others >> 1) | (nextOther << 63)));
+        prevKeyword = keywords >> 63;
+        prevOther = others >> 63;
+    }
+}
+
+size_t findSubstring(const char* src, size_t len, std::string_view needle) {
+    if (needle.empty() || needle.size() > len) {
+        return needle.empty() ? 0 : NPOS;
+    }
+    return dispatch().kernels.find(src, len, needle.data(), needle.size());
+}
+
+size_t findLastSubstring(const char* src, size_t len, std::string_view needle) {
+    if (needle.empty() || needle.size() > len) {
+        return needle.empty() ? len : NPOS;
+    }
+    return dispatch().kernels.findLast(src, len, needle.data(), needle.size());
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Byte-scanning kernels behind tab expansion, cursor column mapping, newline
+// indexing, word motions and search. Each has AVX2, SSE2 and scalar
+// versions; the best one the CPU supports is picked the first time any
+// kernel runs.
+enum class SimdLevel {
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+SimdLevel simdLevel();
+const char* simdLevelName(SimdLevel level);
+
+// Best level this CPU can run
+SimdLevel detectSimdLevel();
+
+// Force a level, e.g. to compare them. Not thread safe
+void setSimdLevel(SimdLevel level);
+
+// Append `len` bytes of `src` to `out`, each tab replaced by `tabStop` spaces
+void expandTabs(const char* src, size_t len, int tabStop, std::string& out);
+
+// Render column of byte `cx` in a row of `len` bytes, a tab being `tabStop`
+// columns wide
+int cxToRx(const char* row, size_t len, size_t cx, int tabStop);
+
+// Append the offset of every '\n' in [src, src + len) to `out`. `len` must
+// be under 4 GiB
+void findNewlines(const char* src, size_t len, std::vector<uint32_t>& out);
+
+// Where words start and end in [src, src + len), one bit per byte in 64 bit
+// words. A word is a run of keyword characters (letters, digits and '_') or a
+// run of other non-blank characters
+void wordBoundaries(const char* src, size_t len, std::vector<uint64_t>& starts, std::vector<uint64_t>& ends);
+
+// Offset of the first place `needle` occurs in [src, src + len), or npos.
+// Blocks of candidates are filtered on the needle's first and last bytes, and
+// only those passing both are compared in full
+size_t findSubstring(const char* src, size_t len, std::string_view needle);
+
+// Same for the last place it occurs
+size_t findLastSubstring(const char* src, size_t len, std::string_view needle);
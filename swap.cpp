@@ -0,0 +1,679 @@
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <format>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+#include "swap.h"
+#include "utils.h"
+
+// The swap file is a header then records, each a varint payload length, a
+// 4 byte checksum of the type and payload, a type byte and the payload.
+// Numbers in payloads are varints. Replay stops at the first record that's
+// cut short or fails its checksum.
+//
+//   header   "mirtswap", u32 version, u32 pid, u64 base size, i64 base
+//            mtime in ns
+//   INSERT   line, col, then text parts to the end
+//   ERASE    line1, col1, line2, col2
+//   STATE    text parts to the end, making up the whole buffer
+//
+// A text part is (length << 1 | 1) and an offset into the base, or
+// (length << 1) and the bytes themselves
+static constexpr char MAGIC[8] = {'m', 'i', 'r', 't', 's', 'w', 'a', 'p'};
+static constexpr uint32_t VERSION = 1;
+static constexpr size_t HEADER_SIZE = 32;
+
+enum Record : uint8_t {
+    INSERT = 1,
+    ERASE = 2,
+    STATE = 3,
+};
+
+// 32 bit FNV-1a
+static uint32_t checksum(const char* data, size_t length) {
+    uint32_t hash = 0x811c9dc5;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<uint8_t>(data[i])) * 0x01000193;
+    }
+    return hash;
+}
+
+static void putRecord(std::string& out, Record type, std::string_view payload) {
+    putVarint(out, payload.size());
+    size_t at = out.size();
+    out.append(sizeof(uint32_t), '\0');
+    out += static_cast<char>(type);
+    out += payload;
+    uint32_t check = checksum(out.data() + at + sizeof(uint32_t), payload.size() + 1);
+    memcpy(out.data() + at, &check, sizeof(check));
+}
+
+static std::string swapPathOf(const std::string& path) {
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    std::string base = slash == std::string::npos ? path : path.substr(slash + 1);
+    return std::format("{}.{}.swp", dir, base);
+}
+
+static int64_t mtimeOf(const struct stat& st) {
+    return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+static std::unexpected<std::string> fail(const std::string& what) {
+    return std::unexpected(std::format("{}: {}", what, strerror(errno)));
+}
+
+void SwapFile::putParts(std::string& out, const Buffer::Snapshot& text, std::string_view rest, const Base& base) {
+    // Runs of the base that follow on are one reference
+    uint64_t refOffset = 0;
+    uint64_t refLength = 0;
+    auto flushRef = [&] {
+        if (refLength > 0) {
+            putVarint(out, refLength << 1 | 1);
+            putVarint(out, refOffset);
+        }
+        refLength = 0;
+    };
+    auto put = [&](std::string_view span) {
+        std::optional<uint64_t> offset = base.find(span);
+        if (offset && refLength > 0 && refOffset + refLength == *offset) {
+            refLength += span.size();
+            return;
+        }
+        flushRef();
+        if (offset) {
+            refOffset = *offset;
+            refLength = span.size();
+        }
+        else {
+            putVarint(out, span.size() << 1);
+            out += span;
+        }
+    };
+    Buffer::Spans spans = text.spans();
+    std::string_view span;
+    while (spans.next(span)) {
+        put(span);
+    }
+    if (!rest.empty()) {
+        put(rest);
+        // Indexing it would terminate the last line
+        if (rest.back() != '\n') {
+            put("\n");
+        }
+    }
+    flushRef();
+}
+
+std::optional<uint64_t> SwapFile::Base::find(std::string_view text) const {
+    uintptr_t at = reinterpret_cast<uintptr_t>(text.data());
+    auto next = std::upper_bound(extents.begin(), extents.end(), at, [](uintptr_t at, const Extent& extent) {
+        return at < reinterpret_cast<uintptr_t>(extent.at);
+    });
+    if (next == extents.begin()) {
+        return std::nullopt;
+    }
+    const Extent& extent = *(next - 1);
+    uintptr_t into = at - reinterpret_cast<uintptr_t>(extent.at);
+    if (into + text.size() > extent.length) {
+        return std::nullopt;
+    }
+    return extent.offset + into;
+}
+
+SwapFile::SwapFile(Buffer& buffer) :
+    buffer{buffer},
+    active{false},
+    logged{0},
+    stopping{false},
+    typedLine{0},
+    typedCol{0},
+    typedEndLine{0},
+    typedEndCol{0},
+    compacted{0},
+    created{false},
+    keep{false},
+    failed{false},
+    fd{-1}
+{
+}
+
+SwapFile::~SwapFile() {
+    close();
+}
+
+std::expected<void, std::string> SwapFile::open(const std::string& path) {
+    close();
+    this->path = path;
+    swapPath = swapPathOf(path);
+
+    // Left by a crash, or another editor has the file open
+    int existing = ::open(swapPath.c_str(), O_RDONLY);
+    if (existing != -1) {
+        char header[HEADER_SIZE];
+        struct stat st;
+        bool whole = read(existing, header, HEADER_SIZE) == (ssize_t)HEADER_SIZE && fstat(existing, &st) == 0;
+        ::close(existing);
+        if (whole && memcmp(header, MAGIC, sizeof(MAGIC)) == 0) {
+            uint32_t pid;
+            memcpy(&pid, header + 12, sizeof(pid));
+            if (pid != (uint32_t)getpid() && kill(pid, 0) == 0) {
+                return std::unexpected(std::format("{} is in use by process {}; not keeping a swap file", swapPath, pid));
+            }
+            if ((size_t)st.st_size > HEADER_SIZE) {
+                return std::unexpected(std::format("Found {} from a crash. Recover with mirt -r {}", swapPath, path));
+            }
+        }
+    }
+    start(path, originalBase(path), false);
+    return {};
+}
+
+std::expected<size_t, std::string> SwapFile::recover(const std::string& path) {
+    close();
+    this->path = path;
+    swapPath = swapPathOf(path);
+
+    int in = ::open(swapPath.c_str(), O_RDONLY);
+    if (in == -1) {
+        return fail(std::format("Can't open {}", swapPath));
+    }
+    std::string log;
+    char chunk[1 << 16];
+    ssize_t nread;
+    while ((nread = read(in, chunk, sizeof(chunk))) > 0) {
+        log.append(chunk, nread);
+    }
+    ::close(in);
+    if (log.size() < HEADER_SIZE || memcmp(log.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        return std::unexpected(std::format("{} isn't a swap file", swapPath));
+    }
+    uint32_t version, pid;
+    uint64_t size;
+    int64_t mtime;
+    memcpy(&version, log.data() + 8, sizeof(version));
+    memcpy(&pid, log.data() + 12, sizeof(pid));
+    memcpy(&size, log.data() + 16, sizeof(size));
+    memcpy(&mtime, log.data() + 24, sizeof(mtime));
+    if (version != VERSION) {
+        return std::unexpected(std::format("{} is from another version", swapPath));
+    }
+    if (pid != (uint32_t)getpid() && kill(pid, 0) == 0) {
+        return std::unexpected(std::format("{} is in use by process {}", swapPath, pid));
+    }
+    BasePtr base = originalBase(path);
+    if (base->size != size || base->mtime != mtime) {
+        return std::unexpected(std::format("{} changed since {} was written", path, swapPath));
+    }
+
+    buffer.indexAll();
+    size_t edits = replay(log.data(), log.size());
+    // The new swap file replaces the old one only once it holds everything
+    start(path, base, true);
+    return edits;
+}
+
+void SwapFile::inserted(size_t line, size_t col, std::string_view text) {
+    if (!active) {
+        return;
+    }
+    size_t lastNewline = text.rfind('\n');
+    size_t endLine = line;
+    size_t endCol = col + text.size();
+    if (lastNewline != std::string_view::npos) {
+        endLine += std::count(text.begin(), text.end(), '\n');
+        endCol = text.size() - lastNewline - 1;
+    }
+    bool full;
+    {
+        std::lock_guard<std::mutex> held(lock);
+        // Typing runs on from where it left off, and is one record
+        if (!typed.empty() && std::tie(typedEndLine, typedEndCol) != std::tie(line, col)) {
+            flushTyped();
+        }
+        if (typed.empty()) {
+            typedLine = line;
+            typedCol = col;
+        }
+        typed += text;
+        typedEndLine = endLine;
+        typedEndCol = endCol;
+        full = added(text.size());
+    }
+    if (full) {
+        compact(base);
+    }
+}
+
+void SwapFile::pasted(size_t line, size_t col, const Buffer::Snapshot& text) {
+    if (!active) {
+        return;
+    }
+    payload.clear();
+    putVarint(payload, line);
+    putVarint(payload, col);
+    putParts(payload, text, {}, *base);
+    bool full;
+    {
+        std::lock_guard<std::mutex> held(lock);
+        flushTyped();
+        size_t before = pending.size();
+        putRecord(pending, INSERT, payload);
+        full = added(pending.size() - before);
+    }
+    if (full) {
+        compact(base);
+    }
+}
+
+void SwapFile::erased(size_t line1, size_t col1, size_t line2, size_t col2) {
+    if (!active) {
+        return;
+    }
+    payload.clear();
+    for (size_t n : {line1, col1, line2, col2}) {
+        putVarint(payload, n);
+    }
+    bool full;
+    {
+        std::lock_guard<std::mutex> held(lock);
+        flushTyped();
+        size_t before = pending.size();
+        putRecord(pending, ERASE, payload);
+        full = added(pending.size() - before);
+    }
+    if (full) {
+        compact(base);
+    }
+}
+
+void SwapFile::saved(const std::string& path, Buffer::Snapshot text) {
+    if (!active && path == this->path) {
+        // Another editor's swap file, or one to recover, is in the way
+        return;
+    }
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1) {
+        return;
+    }
+    auto next = std::make_shared<Base>();
+    uint64_t offset = 0;
+    Buffer::Spans spans = text.spans();
+    std::string_view span;
+    while (spans.next(span)) {
+        next->extents.push_back({span.data(), span.size(), offset});
+        offset += span.size();
+    }
+    std::sort(next->extents.begin(), next->extents.end(), [](const Base::Extent& a, const Base::Extent& b) {
+        return reinterpret_cast<uintptr_t>(a.at) < reinterpret_cast<uintptr_t>(b.at);
+    });
+    next->pin = std::move(text);
+    next->size = st.st_size;
+    next->mtime = mtimeOf(st);
+
+    if (path != this->path || !active) {
+        // Saved under a new name, and the old swap file goes
+        close();
+        this->path = path;
+        swapPath = swapPathOf(path);
+        start(path, std::move(next), true);
+        return;
+    }
+    base = std::move(next);
+    compact(base);
+}
+
+void SwapFile::close() {
+    if (!active) {
+        return;
+    }
+    stop(false);
+    unlink(swapPath.c_str());
+}
+
+void SwapFile::preserve() {
+    if (active) {
+        stop(true);
+    }
+}
+
+void SwapFile::stop(bool keep) {
+    {
+        std::lock_guard<std::mutex> held(lock);
+        stopping = true;
+        this->keep = keep;
+    }
+    wake.notify_one();
+    writer.join();
+    if (fd != -1) {
+        ::close(fd);
+    }
+    fd = -1;
+    active = false;
+    stopping = false;
+    this->keep = false;
+    pending.clear();
+    typed.clear();
+    compaction.reset();
+    base.reset();
+}
+
+std::optional<std::string> SwapFile::takeError() {
+    if (!failed.exchange(false)) {
+        return std::nullopt;
+    }
+    std::optional<std::string> taken;
+    {
+        std::lock_guard<std::mutex> held(lock);
+        taken = std::move(error);
+        error.reset();
+    }
+    if (!active) {
+        return taken;
+    }
+    bool started;
+    {
+        std::lock_guard<std::mutex> held(lock);
+        started = created;
+    }
+    // What failed may have left the log torn, so start it over. If the swap
+    // file couldn't be created at all, do without one
+    if (started) {
+        compact(base);
+    }
+    else {
+        close();
+    }
+    return taken;
+}
+
+void SwapFile::start(const std::string& path, BasePtr base, bool withText) {
+    this->path = path;
+    swapPath = swapPathOf(path);
+    this->base = std::move(base);
+    logged = 0;
+    compacted = 0;
+    created = false;
+    // The writer's first job is the swap file itself
+    if (withText) {
+        compaction = wholeBuffer(this->base);
+    }
+    else {
+        compaction = Compaction{std::nullopt, {}, this->base};
+    }
+    active = true;
+    writer = std::thread(&SwapFile::writeLoop, this);
+}
+
+SwapFile::BasePtr SwapFile::originalBase(const std::string& path) const {
+    auto base = std::make_shared<Base>();
+    std::string_view original = buffer.original();
+    if (!original.empty()) {
+        base->extents.push_back({original.data(), original.size(), 0});
+    }
+    base->pin = buffer.snapshot();
+    base->size = 0;
+    base->mtime = 0;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+        base->size = st.st_size;
+        base->mtime = mtimeOf(st);
+    }
+    return base;
+}
+
+void SwapFile::flushTyped() {
+    if (typed.empty()) {
+        return;
+    }
+    typedRecord.clear();
+    putVarint(typedRecord, typedLine);
+    putVarint(typedRecord, typedCol);
+    putVarint(typedRecord, typed.size() << 1);
+    typedRecord += typed;
+    putRecord(pending, INSERT, typedRecord);
+    typed.clear();
+}
+
+bool SwapFile::added(size_t bytes) {
+    logged += bytes;
+    // The writer sleeps until there's something, then gives the rest of a
+    // burst SYNC_INTERVAL to come in
+    wake.notify_one();
+    return logged > COMPACT_BYTES && logged > compacted;
+}
+
+void SwapFile::compact(BasePtr base) {
+    {
+        std::lock_guard<std::mutex> held(lock);
+        // Everything logged so far is in the snapshot
+        pending.clear();
+        typed.clear();
+        compaction = wholeBuffer(std::move(base));
+        logged = 0;
+    }
+    wake.notify_one();
+}
+
+SwapFile::Compaction SwapFile::wholeBuffer(BasePtr base) const {
+    // What isn't indexed yet is left as it is, so the input thread never
+    // waits on the rest of a big file
+    return Compaction{buffer.snapshot(), buffer.unindexed(), std::move(base)};
+}
+
+void SwapFile::writeLoop() {
+    std::string writing;
+    std::unique_lock<std::mutex> held(lock);
+    while (true) {
+        wake.wait(held, [this] { return stopping || !pending.empty() || !typed.empty() || compaction; });
+        // A compaction replaces the log, so it has nothing to wait for
+        if (!compaction) {
+            wake.wait_for(held, SYNC_INTERVAL, [this] { return stopping; });
+        }
+        if (stopping && !keep) {
+            return;
+        }
+        bool last = stopping;
+        flushTyped();
+        writing.swap(pending);
+        auto job = std::move(compaction);
+        compaction.reset();
+        held.unlock();
+
+        std::optional<std::string> problem;
+        size_t written = 0;
+        if (job) {
+            auto result = writeCompacted(*job, writing);
+            if (result) {
+                written = *result;
+            }
+            else {
+                problem = result.error();
+            }
+        }
+        else if (fd != -1 && (!writeAll(fd, writing.data(), writing.size()) || fdatasync(fd) == -1)) {
+            problem = fail(std::format("Can't write {}", swapPath)).error();
+        }
+        writing.clear();
+
+        held.lock();
+        if (job && !problem) {
+            compacted = written;
+            created = true;
+        }
+        if (problem) {
+            error = std::move(problem);
+            failed = true;
+            wakeMainLoop();
+        }
+        if (last) {
+            return;
+        }
+    }
+}
+
+std::expected<size_t, std::string> SwapFile::writeCompacted(const Compaction& job, const std::string& records) {
+    const Base& base = *job.base;
+    std::string out(MAGIC, sizeof(MAGIC));
+    uint32_t pid = getpid();
+    out.append(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+    out.append(reinterpret_cast<const char*>(&pid), sizeof(pid));
+    out.append(reinterpret_cast<const char*>(&base.size), sizeof(base.size));
+    out.append(reinterpret_cast<const char*>(&base.mtime), sizeof(base.mtime));
+    if (job.text) {
+        std::string payload;
+        putParts(payload, *job.text, job.rest, base);
+        putRecord(out, STATE, payload);
+    }
+    out += records;
+
+    // Written aside and renamed over, so a crash leaves the old log or the
+    // new one
+    std::string temp = swapPath + ".XXXXXX";
+    int next = mkstemp(temp.data());
+    if (next == -1) {
+        return fail(std::format("Can't create {}", temp));
+    }
+    if (!writeAll(next, out.data(), out.size()) || fdatasync(next) == -1
+            || rename(temp.c_str(), swapPath.c_str()) == -1) {
+        int err = errno;
+        ::close(next);
+        unlink(temp.c_str());
+        errno = err;
+        return fail(std::format("Can't write {}", swapPath));
+    }
+    size_t slash = swapPath.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : swapPath.substr(0, slash + 1);
+    int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd != -1) {
+        fsync(dirFd);
+        ::close(dirFd);
+    }
+    if (fd != -1) {
+        ::close(fd);
+    }
+    fd = next;
+    return out.size();
+}
+
+size_t SwapFile::replay(const char* log, size_t size) {
+    std::string_view original = buffer.original();
+    auto valid = [this](uint64_t line, uint64_t col) {
+        if (line == buffer.lineCount()) {
+            return col == 0;
+        }
+        return line < buffer.lineCount() && col <= buffer.lineLength(line);
+    };
+    struct Part {
+        bool ref;
+        uint64_t offset;
+        std::string_view bytes;
+    };
+    std::vector<Part> parts;
+    // Read text parts up to `end`
+    auto readParts = [&](size_t pos, size_t end) {
+        parts.clear();
+        while (pos < end) {
+            uint64_t tag, offset;
+            if (!getVarint(log, pos, end, tag)) {
+                return false;
+            }
+            uint64_t length = tag >> 1;
+            if (tag & 1) {
+                if (!getVarint(log, pos, end, offset) || offset > original.size() || length > original.size() - offset) {
+                    return false;
+                }
+                parts.push_back({true, offset, std::string_view(original.data() + offset, length)});
+            }
+            else {
+                if (length > end - pos) {
+                    return false;
+                }
+                parts.push_back({false, 0, std::string_view(log + pos, length)});
+                pos += length;
+            }
+        }
+        return true;
+    };
+    // Put the parts in at line, col, last first so each goes in at the
+    // same place
+    auto insertParts = [&](size_t line, size_t col) {
+        for (auto part = parts.rbegin(); part != parts.rend(); ++part) {
+            if (part->ref) {
+                buffer.paste(line, col, buffer.originalSlice(part->offset, part->bytes.size()));
+            }
+            else {
+                buffer.insertText(line, col, part->bytes);
+            }
+        }
+    };
+
+    size_t edits = 0;
+    size_t pos = HEADER_SIZE;
+    while (pos < size) {
+        uint64_t length;
+        if (!getVarint(log, pos, size, length) || size - pos < sizeof(uint32_t) + 1
+                || length > size - pos - sizeof(uint32_t) - 1) {
+            break;
+        }
+        uint32_t check;
+        memcpy(&check, log + pos, sizeof(check));
+        if (checksum(log + pos + sizeof(uint32_t), length + 1) != check) {
+            break;
+        }
+        uint8_t type = log[pos + sizeof(uint32_t)];
+        size_t at = pos + sizeof(uint32_t) + 1;
+        size_t end = at + length;
+        pos = end;
+
+        uint64_t line1, col1, line2, col2;
+        if (type == INSERT) {
+            if (!getVarint(log, at, end, line1) || !getVarint(log, at, end, col1)
+                    || !valid(line1, col1) || !readParts(at, end)) {
+                break;
+            }
+            insertParts(line1, col1);
+        }
+        else if (type == ERASE) {
+            if (!getVarint(log, at, end, line1) || !getVarint(log, at, end, col1)
+                    || !getVarint(log, at, end, line2) || !getVarint(log, at, end, col2)
+                    || !valid(line1, col1) || !valid(line2, col2)
+                    || std::tie(line2, col2) < std::tie(line1, col1)) {
+                break;
+            }
+            buffer.cut(line1, col1, line2, col2);
+        }
+        else if (type == STATE) {
+            if (!readParts(at, end)) {
+                break;
+            }
+            buffer.cut(0, 0, buffer.lineCount(), 0);
+            insertParts(0, 0);
+        }
+        else {
+            break;
+        }
+        ++edits;
+    }
+    return edits;
+}
@@ -0,0 +1,171 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "buffer.h"
+
+// Crash recovery. Every edit is logged to a swap file next to the file,
+// ".name.swp", as a record of where it happened and what went in, so typing
+// costs a few bytes a key rather than a rewrite of the buffer. Records are
+// handed to a writer thread, which creates the swap file, appends whatever
+// has built up and fdatasyncs it every SYNC_INTERVAL, so a burst of typing is
+// one write and one sync and the editor never waits on the disk.
+//
+// Text that's in the file on disk, the base, is logged as a reference to
+// where it is in the base rather than copied. Undoing a big delete or putting
+// a big yank then costs no more than typing. Once the log outgrows what it
+// replaces, it's compacted into one record of the whole buffer, again mostly
+// references, written aside and renamed over the swap file. A save makes the
+// saved file the base and compacts the same way.
+//
+// The swap file is removed when the editor exits normally, and kept when it
+// exits with edits unsaved because the terminal went away. `mirt -r file`
+// replays what's left.
+class SwapFile {
+public:
+    explicit SwapFile(Buffer& buffer);
+    ~SwapFile();
+    SwapFile(const SwapFile&) = delete;
+    SwapFile& operator=(const SwapFile&) = delete;
+
+    // Start logging edits to the buffer, just opened from `path`. Logs
+    // nothing if another editor's swap file, or one with edits to recover,
+    // is in the way, and says so
+    std::expected<void, std::string> open(const std::string& path);
+
+    // Replay the swap file of `path` onto the buffer, just opened from it,
+    // and carry on logging from there. Returns how many edits it held
+    std::expected<size_t, std::string> recover(const std::string& path);
+
+    // Edits to the buffer, as made
+    void inserted(size_t line, size_t col, std::string_view text);
+    void pasted(size_t line, size_t col, const Buffer::Snapshot& text);
+    void erased(size_t line1, size_t col1, size_t line2, size_t col2);
+
+    // The buffer was saved to `path` as `text`, which becomes the base
+    void saved(const std::string& path, Buffer::Snapshot text);
+
+    // Stop logging and remove the swap file
+    void close();
+
+    // Stop logging once everything logged is written and synced, and keep
+    // the swap file to recover from
+    void preserve();
+
+    // The last write that failed, once
+    std::optional<std::string> takeError();
+
+private:
+    static constexpr auto SYNC_INTERVAL = std::chrono::milliseconds(200);
+    // Log bytes before a compaction is worth it, at the least
+    static constexpr size_t COMPACT_BYTES = 1 << 20;
+
+    // The base, with where its text is in memory, so text can be found in it
+    // by address
+    struct Base {
+        struct Extent {
+            const char* at;
+            size_t length;
+            uint64_t offset;
+        };
+        // By address
+        std::vector<Extent> extents;
+        // Keeps the text at those addresses alive and in place
+        Buffer::Snapshot pin;
+        uint64_t size;
+        int64_t mtime;
+
+        // Offset of `text` in the base file, if it's one run of it
+        std::optional<uint64_t> find(std::string_view text) const;
+    };
+    using BasePtr = std::shared_ptr<const Base>;
+
+    Buffer& buffer;
+    std::string path;
+    std::string swapPath;
+    bool active;
+    // Used by the main thread. Records go against this base
+    BasePtr base;
+    // Log bytes since the last compaction
+    size_t logged;
+    // Reused to build records in
+    std::string payload;
+
+    // Shared with the writer, under `lock`
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread writer;
+    bool stopping;
+    // Records the writer hasn't taken yet
+    std::string pending;
+    // Typing not made a record yet: `typed` went in at typedLine, typedCol
+    // and ends at typedEndLine, typedEndCol
+    std::string typed;
+    size_t typedLine;
+    size_t typedCol;
+    size_t typedEndLine;
+    size_t typedEndCol;
+    std::string typedRecord;
+    // A swap file to write, holding the whole buffer against `base`
+    struct Compaction {
+        // The indexed buffer, or none when the buffer is the base as it is
+        std::optional<Buffer::Snapshot> text;
+        // The original file past the indexed buffer, which follows it
+        std::string_view rest;
+        BasePtr base;
+    };
+    // The compaction asked for
+    std::optional<Compaction> compaction;
+    // Bytes the last compaction wrote
+    size_t compacted;
+    // Whether the swap file has been created yet
+    bool created;
+    // Write out what's left on stopping, rather than drop it
+    bool keep;
+    std::optional<std::string> error;
+    std::atomic<bool> failed;
+
+    // Only touched by the writer
+    int fd;
+
+    // Start the writer, which first creates the swap file against `base`,
+    // holding the whole buffer if `withText`, or nothing when the buffer is
+    // the base as it is
+    void start(const std::string& path, BasePtr base, bool withText);
+    // Stop the writer, writing out what's left if `keep`
+    void stop(bool keep);
+
+    // Base of the file the buffer was opened from
+    BasePtr originalBase(const std::string& path) const;
+
+    // Turn the typing so far into a record. Under `lock`
+    void flushTyped();
+    // Tell the writer about a new record. Under `lock`, with it in `pending`.
+    // Returns whether the log has grown enough to compact
+    bool added(size_t bytes);
+    // Have the log rewritten as the whole buffer against `base`
+    void compact(BasePtr base);
+    // The whole buffer as it stands, against `base`
+    Compaction wholeBuffer(BasePtr base) const;
+
+    // Parts making up `text`, as references where it's in `base`
+    static void putParts(std::string& out, const Buffer::Snapshot& text, std::string_view rest, const Base& base);
+
+    void writeLoop();
+    // Write a new swap file holding `job`, then `records`, and switch to it.
+    // Returns the bytes written
+    std::expected<size_t, std::string> writeCompacted(const Compaction& job, const std::string& records);
+
+    // Apply the records of a swap file to the buffer
+    size_t replay(const char* log, size_t size);
+};
@@ -0,0 +1,90 @@
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include "terminal.h"
+#include "utils.h"
+
+TtyTerminal::TtyTerminal() :
+    hungUp{false}
+{
+}
+
+std::pair<int, int> TtyTerminal::size() {
+    auto windowSize = getWindowSize();
+    if (!windowSize.has_value()) {
+        die("getWindowSize");
+    }
+    return windowSize.value();
+}
+
+ssize_t TtyTerminal::read(char* buf, size_t len) {
+    if (hungUp) {
+        return -1;
+    }
+    while (true) {
+        // Raw mode reads return 0 rather than wait
+        ssize_t nread = ::read(STDIN_FILENO, buf, len);
+        if (nread >= 0) {
+            return nread;
+        }
+        if (errno == EAGAIN) {
+            return 0;
+        }
+        if (errno == EIO) {
+            hungUp = true;
+            return -1;
+        }
+        if (errno != EINTR) {
+            die("read");
+        }
+    }
+}
+
+size_t TtyTerminal::write(const char* buf, size_t len) {
+    if (hungUp) {
+        return len;
+    }
+    while (true) {
+        ssize_t n = ::write(STDOUT_FILENO, buf, len);
+        if (n >= 0) {
+            return n;
+        }
+        if (errno == EAGAIN) {
+            return 0;
+        }
+        if (errno == EIO) {
+            hungUp = true;
+            return len;
+        }
+        if (errno != EINTR) {
+            die("write");
+        }
+    }
+}
+
+bool TtyTerminal::wait(int timeout, bool writable) {
+    if (hungUp) {
+        return false;
+    }
+    struct pollfd fds[3] = {
+        {STDIN_FILENO, POLLIN, 0},
+        {wakeupFd(), POLLIN, 0},
+        {STDOUT_FILENO, POLLOUT, 0}
+    };
+    if (poll(fds, writable ? 3 : 2, timeout) == -1) {
+        if (errno == EINTR) {
+            return false;
+        }
+        die("poll");
+    }
+    if (fds[0].revents & (POLLERR | POLLHUP)) {
+        // Input ends, and the editor keeps what it can on the way out
+        hungUp = true;
+        return false;
+    }
+    if (fds[1].revents & POLLIN) {
+        drainWakeups();
+        return true;
+    }
+    return false;
+}
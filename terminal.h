@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <sys/types.h>
+#include <utility>
+
+// Where the editor's keys come from and its frames go. Nothing here may
+// block except wait()
+class Terminal {
+public:
+    virtual ~Terminal() = default;
+
+    // Rows and columns
+    virtual std::pair<int, int> size() = 0;
+
+    // Read up to `len` bytes of whatever input is ready. Returns 0 if there
+    // is none yet and -1 once input has ended for good
+    virtual ssize_t read(char* buf, size_t len) = 0;
+
+    // Write as much of `buf` as the terminal takes. Returns how much that was
+    virtual size_t write(const char* buf, size_t len) = 0;
+
+    // Sleep until there's input, `timeout` ms pass (-1 for no limit), output
+    // can go out if `writable` is set, or another thread calls
+    // wakeMainLoop(). Returns true if woken up by another thread
+    virtual bool wait(int timeout, bool writable) = 0;
+};
+
+// The terminal on stdin and stdout, already put in raw mode. Once it hangs
+// up, input ends and output goes nowhere
+class TtyTerminal : public Terminal {
+public:
+    TtyTerminal();
+    std::pair<int, int> size() override;
+    ssize_t read(char* buf, size_t len) override;
+    size_t write(const char* buf, size_t len) override;
+    bool wait(int timeout, bool writable) override;
+
+private:
+    bool hungUp;
+};
@@ -0,0 +1,668 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <format>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+#include "undo.h"
+#include "utils.h"
+
+// The undo file is a header then records, each a 4 byte payload length, a
+// type byte and the payload. Numbers in step records are varints, fixed
+// ones are in the machine's byte order.
+//
+//   STEP        varint changes, then per change: a byte that's 1 for an
+//               insert, varint line1, col1, line2, col2, text length, text
+//   TRUNCATE    u64 steps: history keeps only its first `steps` steps
+//   CHECKPOINT  u64 steps applied, u64 hash, u64 file size, i64 mtime in ns
+//
+// Saves append, starting over whatever follows the last checkpoint, so a
+// save cut short leaves the history as of the save before
+static constexpr char MAGIC[8] = {'m', 'i', 'r', 't', 'u', 'n', 'd', 'o'};
+static constexpr uint32_t VERSION = 1;
+static constexpr size_t HEADER_SIZE = sizeof(MAGIC) + 8;
+static constexpr size_t RECORD_HEADER = 5;
+static constexpr size_t CHECKPOINT_SIZE = 32;
+
+enum Record : uint8_t {
+    STEP = 1,
+    TRUNCATE = 2,
+    CHECKPOINT = 3,
+};
+
+template <typename T>
+static T readFixed(const char* at) {
+    T value;
+    memcpy(&value, at, sizeof(T));
+    return value;
+}
+
+template <typename T>
+static void putFixed(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// Start a record, returning where its length goes
+static size_t beginRecord(std::string& out, Record type) {
+    size_t at = out.size();
+    putFixed<uint32_t>(out, 0);
+    out += static_cast<char>(type);
+    return at;
+}
+
+static bool endRecord(std::string& out, size_t at) {
+    size_t length = out.size() - at - RECORD_HEADER;
+    if (length > UINT32_MAX) {
+        return false;
+    }
+    uint32_t fixed = length;
+    memcpy(out.data() + at, &fixed, sizeof(fixed));
+    return true;
+}
+
+static void putCheckpoint(std::string& out, uint64_t done, uint64_t hash, uint64_t size, int64_t mtime) {
+    size_t at = beginRecord(out, CHECKPOINT);
+    putFixed(out, done);
+    putFixed(out, hash);
+    putFixed(out, size);
+    putFixed(out, mtime);
+    endRecord(out, at);
+}
+
+static int64_t mtimeOf(const struct stat& st) {
+    return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static bool writeAll(int fd, const std::string& data, off_t offset) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = pwrite(fd, data.data() + written, data.size() - written, offset + written);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+static std::unexpected<std::string> fail(const std::string& what) {
+    return std::unexpected(std::format("{}: {}", what, strerror(errno)));
+}
+
+UndoJournal::UndoJournal(Buffer& buffer, SwapFile& swap) :
+    buffer{buffer},
+    swap{swap},
+    done{0},
+    stepEnded{true},
+    growing{false},
+    total{0},
+    limit{SIZE_MAX},
+    trimmed{0},
+    synced{0},
+    unloaded{0},
+    savedAt{0},
+    fileSize{0},
+    fileMtime{0},
+    log{nullptr},
+    logSize{0},
+    logRead{true},
+    logValid{false},
+    logEnd{0},
+    logHash{0}
+{
+}
+
+UndoJournal::~UndoJournal() {
+    unmap();
+}
+
+std::pair<size_t, size_t> UndoJournal::insert(size_t line, size_t col, std::string_view text) {
+    // Empty changes aren't recorded, as there's nothing to undo
+    if (text.empty()) {
+        return {line, col};
+    }
+    bool extend = extends(line, col);
+    buffer.insertText(line, col, text);
+    swap.inserted(line, col, text);
+    size_t lastNewline = text.rfind('\n');
+    std::pair<size_t, size_t> end{line, col + text.size()};
+    if (lastNewline != std::string_view::npos) {
+        end = {line + std::count(text.begin(), text.end(), '\n'), text.size() - lastNewline - 1};
+    }
+    inserted(extend, line, col, end.first, end.second);
+    return end;
+}
+
+std::pair<size_t, size_t> UndoJournal::paste(size_t line, size_t col, const Buffer::Snapshot& text) {
+    if (text.size() == 0) {
+        return {line, col};
+    }
+    bool extend = extends(line, col);
+    auto end = buffer.paste(line, col, text);
+    swap.pasted(line, col, text);
+    inserted(extend, line, col, end.first, end.second);
+    return end;
+}
+
+Buffer::Snapshot UndoJournal::erase(size_t line1, size_t col1, size_t line2, size_t col2) {
+    if (std::tie(line1, col1) == std::tie(line2, col2)) {
+        // Nothing taken out, so nothing to undo
+        return buffer.slice(line1, col1, line2, col2);
+    }
+    if (growing) {
+        Step& step = steps.back();
+        Change& last = step.changes.back();
+        if (std::tie(last.line2, last.col2) == std::tie(line2, col2)
+                && std::tie(last.line1, last.col1) <= std::tie(line1, col1)) {
+            // Taking back what was just typed
+            Buffer::Snapshot text = buffer.cut(line1, col1, line2, col2);
+            swap.erased(line1, col1, line2, col2);
+            last.line2 = line1;
+            last.col2 = col1;
+            if (std::tie(last.line1, last.col1) == std::tie(last.line2, last.col2)) {
+                step.changes.pop_back();
+                step.bytes -= sizeof(Change);
+                total -= sizeof(Change);
+                growing = false;
+            }
+            return text;
+        }
+    }
+    close();
+    Step& step = current();
+    Buffer::Snapshot text = buffer.cut(line1, col1, line2, col2);
+    swap.erased(line1, col1, line2, col2);
+    step.changes.push_back({line1, col1, line2, col2, false, text, {}});
+    size_t bytes = bytesOf(step.changes.back());
+    step.bytes += bytes;
+    total += bytes;
+    trim();
+    return text;
+}
+
+void UndoJournal::endStep() {
+    close();
+    if (!stepEnded && steps.back().changes.empty()) {
+        // Everything typed was backspaced over
+        steps.pop_back();
+        --done;
+    }
+    stepEnded = true;
+}
+
+std::optional<std::pair<size_t, size_t>> UndoJournal::undo(const EditedFn& edited) {
+    endStep();
+    if (done == 0) {
+        load();
+    }
+    if (done == 0) {
+        return std::nullopt;
+    }
+    Step& step = steps[--done];
+    for (auto change = step.changes.rbegin(); change != step.changes.rend(); ++change) {
+        apply(*change, !change->insert, edited);
+    }
+    recount(step);
+    const Change& first = step.changes.front();
+    return std::make_pair(first.line1, first.col1);
+}
+
+std::optional<std::pair<size_t, size_t>> UndoJournal::redo(const EditedFn& edited) {
+    endStep();
+    // Steps undone before the file was last saved are in the undo file
+    if (steps.empty()) {
+        load();
+    }
+    if (done == steps.size()) {
+        return std::nullopt;
+    }
+    Step& step = steps[done++];
+    for (Change& change : step.changes) {
+        apply(change, change.insert, edited);
+    }
+    recount(step);
+    const Change& first = step.changes.front();
+    return std::make_pair(first.line1, first.col1);
+}
+
+void UndoJournal::clear() {
+    steps.clear();
+    done = 0;
+    stepEnded = true;
+    growing = false;
+    total = 0;
+    trimmed = 0;
+    synced = 0;
+    savedAt = 0;
+}
+
+void UndoJournal::markSaved() {
+    // Changes from here on are a new step
+    endStep();
+    savedAt = trimmed + done;
+}
+
+void UndoJournal::forgetSaved() {
+    savedAt = NOT_SAVED;
+}
+
+bool UndoJournal::modified() const {
+    return trimmed + done != savedAt;
+}
+
+void UndoJournal::open(const std::string& path) {
+    clear();
+    unmap();
+    setPath(path);
+    fileSize = 0;
+    fileMtime = 0;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+        fileSize = st.st_size;
+        fileMtime = mtimeOf(st);
+    }
+
+    // Only mapped here. Reading it waits until it's wanted
+    logRead = false;
+    int fd = ::open(logPath.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            log = static_cast<const char*>(addr);
+            logSize = st.st_size;
+        }
+    }
+    ::close(fd);
+}
+
+std::expected<void, std::string> UndoJournal::save(const std::string& path, uint64_t hash) {
+    // What's been typed so far is all in the file
+    endStep();
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1) {
+        return fail("Can't stat file");
+    }
+    if (path != this->path) {
+        // Saved under a new name. Its history starts with this session. The
+        // old undo file stays mapped, as loaded steps point into it
+        setPath(path);
+        logRead = true;
+        logValid = false;
+        unloaded = 0;
+    }
+    readLog();
+
+    size_t numbered = trimmed + steps.size();
+    if (!logValid || synced < trimmed) {
+        return rewrite(hash, st.st_size, mtimeOf(st));
+    }
+
+    std::string out;
+    if (numbered > synced && logSteps.size() > unloaded + synced) {
+        // Steps undone since they were written have been replaced
+        size_t at = beginRecord(out, TRUNCATE);
+        putFixed<uint64_t>(out, unloaded + synced);
+        endRecord(out, at);
+        logSteps.resize(unloaded + synced);
+    }
+    for (size_t i = synced; i < numbered; ++i) {
+        logSteps.push_back(logEnd + out.size());
+        if (!putStep(out, steps[i - trimmed])) {
+            logValid = false;
+            return std::unexpected("Step too big for the undo file");
+        }
+    }
+    putCheckpoint(out, unloaded + trimmed + done, hash, st.st_size, mtimeOf(st));
+
+    int fd = ::open(logPath.c_str(), O_WRONLY);
+    if (fd == -1) {
+        return rewrite(hash, st.st_size, mtimeOf(st));
+    }
+    // Whatever follows the last checkpoint is from a save cut short
+    bool ok = writeAll(fd, out, logEnd) && ftruncate(fd, logEnd + out.size()) == 0 && fdatasync(fd) == 0;
+    int err = errno;
+    ::close(fd);
+    if (!ok) {
+        // Start over on the next save
+        logValid = false;
+        errno = err;
+        return fail("Can't write undo file");
+    }
+    logEnd += out.size();
+    synced = numbered;
+    return {};
+}
+
+void UndoJournal::setLimit(size_t bytes) {
+    limit = bytes;
+    trim();
+}
+
+size_t UndoJournal::bytes() const {
+    return total;
+}
+
+UndoJournal::Step& UndoJournal::current() {
+    // A change after an undo makes the undone steps unreachable
+    while (steps.size() > done) {
+        total -= steps.back().bytes;
+        steps.pop_back();
+    }
+    synced = std::min(synced, trimmed + done);
+    if (savedAt != NOT_SAVED && savedAt > trimmed + done) {
+        savedAt = NOT_SAVED;
+    }
+    if (stepEnded || steps.empty()) {
+        steps.emplace_back();
+        ++done;
+        stepEnded = false;
+    }
+    return steps.back();
+}
+
+bool UndoJournal::extends(size_t line, size_t col) {
+    if (growing) {
+        const Change& last = steps.back().changes.back();
+        if (std::tie(last.line2, last.col2) == std::tie(line, col)) {
+            return true;
+        }
+    }
+    close();
+    return false;
+}
+
+void UndoJournal::close() {
+    if (!growing) {
+        return;
+    }
+    growing = false;
+    Step& step = steps.back();
+    Change& last = step.changes.back();
+    last.text = buffer.slice(last.line1, last.col1, last.line2, last.col2);
+    step.bytes += last.text.bytes();
+    total += last.text.bytes();
+}
+
+void UndoJournal::inserted(bool extend, size_t line1, size_t col1, size_t line2, size_t col2) {
+    if (extend) {
+        Change& last = steps.back().changes.back();
+        last.line2 = line2;
+        last.col2 = col2;
+        return;
+    }
+    Step& step = current();
+    step.changes.push_back({line1, col1, line2, col2, true, {}, {}});
+    step.bytes += sizeof(Change);
+    total += sizeof(Change);
+    growing = true;
+    trim();
+}
+
+void UndoJournal::apply(Change& change, bool insert, const EditedFn& edited) {
+    long lines = change.line2 - change.line1;
+    if (insert) {
+        if (change.text.size() > 0) {
+            buffer.paste(change.line1, change.col1, change.text);
+            swap.pasted(change.line1, change.col1, change.text);
+        }
+        else {
+            buffer.insertText(change.line1, change.col1, change.stored);
+            swap.inserted(change.line1, change.col1, change.stored);
+        }
+        edited(change.line1, lines);
+    }
+    else {
+        change.text = buffer.cut(change.line1, change.col1, change.line2, change.col2);
+        swap.erased(change.line1, change.col1, change.line2, change.col2);
+        edited(change.line1, -lines);
+    }
+}
+
+size_t UndoJournal::bytesOf(const Change& change) {
+    return sizeof(Change) + change.text.bytes();
+}
+
+void UndoJournal::recount(Step& step) {
+    total -= step.bytes;
+    step.bytes = 0;
+    for (const Change& change : step.changes) {
+        step.bytes += bytesOf(change);
+    }
+    total += step.bytes;
+}
+
+void UndoJournal::trim() {
+    while (total > limit && done > 1) {
+        total -= steps.front().bytes;
+        steps.pop_front();
+        --done;
+        ++trimmed;
+    }
+}
+
+void UndoJournal::setPath(const std::string& path) {
+    this->path = path;
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    std::string base = slash == std::string::npos ? path : path.substr(slash + 1);
+    logPath = std::format("{}.{}.un~", dir, base);
+}
+
+void UndoJournal::unmap() {
+    if (log) {
+        munmap(const_cast<char*>(log), logSize);
+    }
+    log = nullptr;
+    logSize = 0;
+}
+
+void UndoJournal::readLog() {
+    if (logRead) {
+        return;
+    }
+    logRead = true;
+    logValid = false;
+    logSteps.clear();
+    logEnd = 0;
+    unloaded = 0;
+    if (logSize < HEADER_SIZE || memcmp(log, MAGIC, sizeof(MAGIC)) != 0
+            || readFixed<uint32_t>(log + sizeof(MAGIC)) != VERSION) {
+        return;
+    }
+
+    // Find the last checkpoint. Anything after it is from a save cut short
+    size_t checkpoint = 0;
+    for (size_t pos = HEADER_SIZE; logSize - pos >= RECORD_HEADER;) {
+        uint32_t length = readFixed<uint32_t>(log + pos);
+        if (length > logSize - pos - RECORD_HEADER) {
+            break;
+        }
+        if (log[pos + 4] == CHECKPOINT && length == CHECKPOINT_SIZE) {
+            checkpoint = pos;
+        }
+        pos += RECORD_HEADER + length;
+    }
+    if (checkpoint == 0) {
+        return;
+    }
+
+    // Play the steps and truncations up to it to learn which steps make up
+    // the history. Only offsets are kept; steps are parsed when loaded
+    for (size_t pos = HEADER_SIZE; pos < checkpoint;) {
+        uint32_t length = readFixed<uint32_t>(log + pos);
+        uint8_t type = log[pos + 4];
+        if (type == STEP) {
+            logSteps.push_back(pos);
+        }
+        else if (type == TRUNCATE) {
+            if (length != sizeof(uint64_t)) {
+                logSteps.clear();
+                return;
+            }
+            uint64_t keep = readFixed<uint64_t>(log + pos + RECORD_HEADER);
+            logSteps.resize(std::min<uint64_t>(keep, logSteps.size()));
+        }
+        pos += RECORD_HEADER + length;
+    }
+
+    const char* fields = log + checkpoint + RECORD_HEADER;
+    uint64_t applied = readFixed<uint64_t>(fields);
+    uint64_t size = readFixed<uint64_t>(fields + 16);
+    int64_t mtime = readFixed<int64_t>(fields + 24);
+    // Saved by something else since, and the history no longer applies
+    if (applied > logSteps.size() || size != fileSize || mtime != fileMtime) {
+        logSteps.clear();
+        return;
+    }
+    logValid = true;
+    logEnd = checkpoint + RECORD_HEADER + CHECKPOINT_SIZE;
+    logHash = readFixed<uint64_t>(fields + 8);
+    unloaded = applied;
+}
+
+void UndoJournal::load() {
+    readLog();
+    if (!logValid || trimmed != 0) {
+        return;
+    }
+    // Steps undone in the file are only wanted if the session hasn't
+    // replaced them
+    bool redo = steps.empty() && logSteps.size() > unloaded;
+    if (unloaded == 0 && !redo) {
+        return;
+    }
+    buffer.indexAll();
+    if (buffer.snapshot().hash() != logHash) {
+        logValid = false;
+        return;
+    }
+
+    size_t count = redo ? logSteps.size() : unloaded;
+    std::deque<Step> loaded(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (!readStep(logSteps[i], loaded[i])) {
+            logValid = false;
+            return;
+        }
+        for (const Change& change : loaded[i].changes) {
+            loaded[i].bytes += bytesOf(change);
+        }
+        total += loaded[i].bytes;
+    }
+    // Numbering now starts at the first step of the file
+    done += unloaded;
+    synced = redo ? count : synced + unloaded;
+    if (savedAt != NOT_SAVED) {
+        savedAt += unloaded;
+    }
+    for (Step& step : steps) {
+        loaded.push_back(std::move(step));
+    }
+    steps = std::move(loaded);
+    unloaded = 0;
+    trim();
+}
+
+bool UndoJournal::putStep(std::string& out, const Step& step) {
+    size_t at = beginRecord(out, STEP);
+    putVarint(out, step.changes.size());
+    for (const Change& change : step.changes) {
+        out += static_cast<char>(change.insert);
+        putVarint(out, change.line1);
+        putVarint(out, change.col1);
+        putVarint(out, change.line2);
+        putVarint(out, change.col2);
+        if (change.text.size() == 0 && !change.stored.empty()) {
+            putVarint(out, change.stored.size());
+            out += change.stored;
+            continue;
+        }
+        putVarint(out, change.text.size());
+        Buffer::Spans spans = change.text.spans();
+        std::string_view span;
+        while (spans.next(span)) {
+            out += span;
+        }
+    }
+    return endRecord(out, at);
+}
+
+bool UndoJournal::readStep(size_t offset, Step& step) const {
+    size_t pos = offset + RECORD_HEADER;
+    size_t end = pos + readFixed<uint32_t>(log + offset);
+    uint64_t count;
+    if (!getVarint(log, pos, end, count) || count == 0 || count > end - pos) {
+        return false;
+    }
+    step.changes.resize(count);
+    for (Change& change : step.changes) {
+        uint64_t length;
+        if (pos >= end) {
+            return false;
+        }
+        change.insert = log[pos++] == 1;
+        if (!getVarint(log, pos, end, change.line1) || !getVarint(log, pos, end, change.col1)
+                || !getVarint(log, pos, end, change.line2) || !getVarint(log, pos, end, change.col2)
+                || !getVarint(log, pos, end, length) || length > end - pos) {
+            return false;
+        }
+        change.stored = std::string_view(log + pos, length);
+        pos += length;
+    }
+    return true;
+}
+
+std::expected<void, std::string> UndoJournal::rewrite(uint64_t hash, uint64_t size, int64_t mtime) {
+    std::string out(MAGIC, sizeof(MAGIC));
+    putFixed(out, VERSION);
+    putFixed<uint32_t>(out, 0);
+    std::vector<size_t> offsets;
+    for (const Step& step : steps) {
+        offsets.push_back(out.size());
+        if (!putStep(out, step)) {
+            return std::unexpected("Step too big for the undo file");
+        }
+    }
+    putCheckpoint(out, done, hash, size, mtime);
+
+    // Written aside and renamed over, so the old one stays whole until then,
+    // and so does its mapping
+    std::string temp = logPath + ".XXXXXX";
+    int fd = mkstemp(temp.data());
+    if (fd == -1) {
+        return fail("Can't create undo file");
+    }
+    bool ok = writeAll(fd, out, 0) && fsync(fd) == 0;
+    int err = errno;
+    ::close(fd);
+    if (!ok || rename(temp.c_str(), logPath.c_str()) == -1) {
+        err = ok ? errno : err;
+        unlink(temp.c_str());
+        errno = err;
+        return fail("Can't write undo file");
+    }
+
+    // Numbering starts over at the first step kept
+    logValid = true;
+    logEnd = out.size();
+    logSteps = std::move(offsets);
+    unloaded = 0;
+    if (savedAt != NOT_SAVED) {
+        // A save trimmed out of history can't be got back to
+        savedAt = savedAt >= trimmed ? savedAt - trimmed : NOT_SAVED;
+    }
+    trimmed = 0;
+    synced = steps.size();
+    return {};
+}
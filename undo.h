@@ -0,0 +1,193 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "buffer.h"
+#include "swap.h"
+
+// Undo and redo history. Edits are made through the journal, which records
+// the span of text each put into or took out of the buffer. The text is held
+// as a Snapshot sharing the buffer's pieces, so recording a change never
+// copies its text, and undoing one costs time in proportion to the change,
+// never the file.
+//
+// Changes are grouped into steps, which undo and redo as one. Text typed
+// right where the last change ended extends that change, and backspacing
+// over it shrinks it, so an insert session is usually a single change.
+//
+// Steps past a memory limit are dropped, oldest first.
+//
+// History also outlives the session in an undo file next to the file,
+// ".name.un~". Each save appends length prefixed records to it: the steps
+// made since the last save, a truncation where undone steps were replaced,
+// and a checkpoint tying the history to the saved text by its size, mtime
+// and hash. Opening a file only maps its undo file. It's read the first time
+// undo runs out of this session's steps.
+//
+// Every edit is passed on to the swap file as well, for crash recovery.
+class UndoJournal {
+public:
+    // Told the first line a change touched and the lines it added, negative
+    // if it removed some, like Editor::edited
+    using EditedFn = std::function<void(size_t line, long added)>;
+
+    UndoJournal(Buffer& buffer, SwapFile& swap);
+    ~UndoJournal();
+    UndoJournal(const UndoJournal&) = delete;
+    UndoJournal& operator=(const UndoJournal&) = delete;
+
+    // Insert `text`, which may span lines, at line, col. `line` may be
+    // lineCount() to append. Returns the line and column just past it
+    std::pair<size_t, size_t> insert(size_t line, size_t col, std::string_view text);
+
+    // Same for text out of a snapshot, see Buffer::paste
+    std::pair<size_t, size_t> paste(size_t line, size_t col, const Buffer::Snapshot& text);
+
+    // Take out the text from line1, col1 up to line2, col2 and return it
+    Buffer::Snapshot erase(size_t line1, size_t col1, size_t line2, size_t col2);
+
+    // The next change starts a new step
+    void endStep();
+
+    // Undo the last step, or redo the last one undone. Returns where the
+    // step starts, or nothing if there was no step
+    std::optional<std::pair<size_t, size_t>> undo(const EditedFn& edited);
+    std::optional<std::pair<size_t, size_t>> redo(const EditedFn& edited);
+
+    // Forget every step, e.g. after putting a line in an empty file
+    void clear();
+
+    // The buffer now matches the file. Undo and redo coming back to here
+    // make it unmodified again
+    void markSaved();
+
+    // The buffer matches the file at no step, as after recovering edits
+    // from the swap file
+    void forgetSaved();
+
+    // Whether the steps applied differ from those at the last save
+    bool modified() const;
+
+    // Forget every step and map the undo file of `path`, just opened
+    void open(const std::string& path);
+
+    // Bring the undo file up to date with the buffer just saved to `path`.
+    // `hash` is Snapshot::hash() of what was written
+    std::expected<void, std::string> save(const std::string& path, uint64_t hash);
+
+    // Keep history to about `bytes`. The last step is kept whatever its size
+    void setLimit(size_t bytes);
+
+    size_t bytes() const;
+
+private:
+    struct Change {
+        size_t line1;
+        size_t col1;
+        size_t line2;
+        size_t col2;
+        // Whether the change put text in, rather than took it out
+        bool insert;
+        // The text. Empty while an insert is still growing, as only the
+        // buffer has it then
+        Buffer::Snapshot text;
+        // The text in the undo file, for changes loaded from it
+        std::string_view stored;
+    };
+
+    struct Step {
+        std::vector<Change> changes;
+        size_t bytes = 0;
+    };
+
+    Buffer& buffer;
+    SwapFile& swap;
+    std::deque<Step> steps;
+    // Steps [0, done) are applied, the rest were undone
+    size_t done;
+    bool stepEnded;
+    // The last change is an insert that may still grow
+    bool growing;
+    size_t total;
+    size_t limit;
+
+    // Steps are numbered from the first of the session, or of what was
+    // loaded from the undo file. steps[i] is number trimmed + i, as
+    // `trimmed` were dropped for memory
+    size_t trimmed;
+    // Steps numbered [0, synced) are in the undo file as they are here
+    size_t synced;
+    // Steps in the undo file before number 0, not loaded yet
+    size_t unloaded;
+    // Number of the last step applied when the buffer matched the file, or
+    // NOT_SAVED once no step does
+    static constexpr size_t NOT_SAVED = SIZE_MAX;
+    size_t savedAt;
+
+    // The file edited, and its size and mtime when opened
+    std::string path;
+    uint64_t fileSize;
+    int64_t fileMtime;
+
+    std::string logPath;
+    // The undo file as it was when opened
+    const char* log;
+    size_t logSize;
+    bool logRead;
+    // Its last checkpoint matches the file as opened
+    bool logValid;
+    // Bytes up to the end of the last checkpoint. Appends go here
+    size_t logEnd;
+    // Offsets of the step records making up its history
+    std::vector<size_t> logSteps;
+    // Hash of the text at the last checkpoint
+    uint64_t logHash;
+
+    // The step changes go in, starting one if the last has ended
+    Step& current();
+
+    // Whether an insert at line, col extends the growing change. Takes the
+    // growing change's text out of the buffer if not, before the buffer
+    // moves on
+    bool extends(size_t line, size_t col);
+    void close();
+
+    // Record an insert that ended at line2, col2
+    void inserted(bool extend, size_t line1, size_t col1, size_t line2, size_t col2);
+
+    // Put the change's text in the buffer, or take it out
+    void apply(Change& change, bool insert, const EditedFn& edited);
+
+    static size_t bytesOf(const Change& change);
+    void recount(Step& step);
+
+    // Drop the oldest steps while over the limit
+    void trim();
+
+    // Edit `path`, with its undo file beside it
+    void setPath(const std::string& path);
+    void unmap();
+
+    // Parse the undo file's records, once
+    void readLog();
+
+    // Put the undo file's steps in front of the session's. Only done while
+    // the buffer is as it was opened
+    void load();
+
+    // Append a step record. False if it's too big for one
+    static bool putStep(std::string& out, const Step& step);
+
+    // Step record at `offset` of the undo file into `step`
+    bool readStep(size_t offset, Step& step) const;
+
+    // Write a new undo file holding the steps in memory
+    std::expected<void, std::string> rewrite(uint64_t hash, uint64_t size, int64_t mtime);
+};
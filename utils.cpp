@@ -1,4 +1,7 @@
+#include <errno.h>
 #include <expected>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
 #include <termios.h>
@@ -7,9 +10,11 @@
 #include <string>
 #include <utility>
 #include "constants.h"
+#include "simd.h"
 #include "utils.h"
 
 struct termios orig_termios;
+int orig_stdout_flags;
 void die(const char *s) {
     // Clear screen
     write(STDOUT_FILENO, "\x1b[2J", 4);
@@ -22,22 +27,54 @@ void die(const char *s) {
 }
 
 void disableRawMode() {
+    fcntl(STDOUT_FILENO, F_SETFL, orig_stdout_flags);
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios) == -1) {
+        // A terminal that hung up has nothing to restore
+        if (errno == EIO) {
+            return;
+        }
         die("tcsetattr");
     }
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
     thinCursor();
 }
 
+// Read and write ends of the wakeup pipe, made on first use
+static const int* wakeupPipe() {
+    static int fds[2];
+    static bool opened = pipe2(fds, O_NONBLOCK | O_CLOEXEC) == 0;
+    if (!opened) {
+        die("pipe2");
+    }
+    return fds;
+}
+
+int wakeupFd() {
+    return wakeupPipe()[0];
+}
+
+void wakeMainLoop() {
+    char c = 0;
+    // A full pipe already has the main loop coming
+    if (write(wakeupPipe()[1], &c, 1) == -1) {}
+}
+
+void drainWakeups() {
+    char buf[256];
+    while (read(wakeupFd(), buf, sizeof(buf)) > 0) {}
+}
+
 void thinCursor() {
-    write(STDOUT_FILENO, "\x1b[0 q", 6);
+    write(STDOUT_FILENO, THIN_CURSOR.data(), THIN_CURSOR.size());
 }
 
 void thickCursor() {
-    write(STDOUT_FILENO, "\x1b[2 q", 6);
+    write(STDOUT_FILENO, THICK_CURSOR.data(), THICK_CURSOR.size());
 }
 
 void enableRawMode() {
     if (tcgetattr(STDIN_FILENO, &orig_termios) == -1) die("tcgetattr");
+    orig_stdout_flags = fcntl(STDOUT_FILENO, F_GETFL);
     atexit(disableRawMode);
 
     struct termios raw;
@@ -46,11 +83,17 @@ void enableRawMode() {
     raw.c_oflag &= ~(OPOST);
     raw.c_cflag |= (CS8);
     raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    // Reads never block; the input loop polls instead
     raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 1;
+    raw.c_cc[VTIME] = 0;
 
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
     thickCursor();
+    // Have pastes marked so they can go in as one insert
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
+
+    // Frames go out through Output, which never waits on the terminal
+    fcntl(STDOUT_FILENO, F_SETFL, orig_stdout_flags | O_NONBLOCK);
 }
 
 std::expected<std::pair<int, int>, std::string> getCursorPosition() {
@@ -61,7 +104,9 @@ std::expected<std::pair<int, int>, std::string> getCursorPosition() {
         return std::unexpected("Get cursor position failed");
 
     while (i < sizeof(buf) - 1) {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1)
+        // Reads don't wait in raw mode, so give the terminal a moment
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        if (poll(&pfd, 1, 1000) != 1 || read(STDIN_FILENO, &buf[i], 1) != 1)
             break;
         if (buf[i] == 'R')
             break;
@@ -91,22 +136,9 @@ std::expected<std::pair<int, int>, std::string> getWindowSize() {
     }
 }
 
-std::string parseLine(const std::string& line) {
-    int tabs = 0;
-    std::string ret = "";
-    for (const char ch : line) {
-        if (ch == '\t') {
-            ++tabs;
-        }
-        else {
-            std::string tab = std::string(TAB_STOP, ' ');
-            for (int i = 0; i < tabs; ++i) {
-                ret += tab;
-            }
-            tabs = 0;
-            ret += ch;
-        }
-    }
+std::string parseLine(const std::string& line, int tabStop) {
+    std::string ret;
+    expandTabs(line.data(), line.size(), tabStop, ret);
     return ret;
 }
 
@@ -118,3 +150,23 @@ size_t firstNonWhitespace(const std::string& line) {
     }
     return 0;
 }
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+bool getVarint(const char* data, size_t& pos, size_t end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+        uint8_t byte = data[pos++];
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
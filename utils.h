@@ -1,5 +1,7 @@
 #pragma once
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <expected>
 void die(const char *s);
 void disableRawMode();
@@ -7,10 +9,25 @@ void enableRawMode();
 std::expected<std::pair<int, int>, std::string> getCursorPosition();
 std::expected<std::pair<int, int>, std::string> getWindowSize();
 
+// Self-pipe the input loop polls, so other threads can have the screen
+// redrawn when they get something done
+int wakeupFd();
+void wakeMainLoop();
+void drainWakeups();
+
+// Cursor shapes for insert and normal mode
+inline constexpr std::string_view THIN_CURSOR = "\x1b[0 q";
+inline constexpr std::string_view THICK_CURSOR = "\x1b[2 q";
+
 void thinCursor();
 void thickCursor();
 
-// Turn tabs into spaces
-std::string parseLine(const std::string& line);
+// Turn each tab into `tabStop` spaces
+std::string parseLine(const std::string& line, int tabStop);
 
 size_t firstNonWhitespace(const std::string& line);
+
+// LEB128 varints, for the undo and swap files. getVarint reads one at `pos`
+// and moves past it, returning false if it runs off `end`
+void putVarint(std::string& out, uint64_t value);
+bool getVarint(const char* data, size_t& pos, size_t end, uint64_t& value);
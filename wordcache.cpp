@@ -0,0 +1,70 @@
+#include <cassert>
+#include "simd.h"
+#include "wordcache.h"
+
+WordCache::WordCache() : entries(ENTRIES) {
+}
+
+const WordCache::Bits& WordCache::get(const Buffer& buffer, size_t line) {
+    Entry& entry = entries[line % entries.size()];
+    if (!entry.valid || entry.line != line) {
+        buffer.readLine(line, text);
+        wordBoundaries(text.data(), text.size(), entry.bits.starts, entry.bits.ends);
+        entry.bits.length = text.size();
+        entry.valid = true;
+        entry.line = line;
+    }
+    return entry.bits;
+}
+
+void WordCache::invalidate(size_t line) {
+    Entry& entry = entries[line % entries.size()];
+    if (entry.line == line) {
+        entry.valid = false;
+    }
+}
+
+void WordCache::invalidateFrom(size_t line) {
+    for (Entry& entry : entries) {
+        if (entry.line >= line) {
+            entry.valid = false;
+        }
+    }
+}
+
+size_t countBits(const std::vector<uint64_t>& bits) {
+    size_t count = 0;
+    for (uint64_t word : bits) {
+        count += __builtin_popcountll(word);
+    }
+    return count;
+}
+
+size_t countBits(const std::vector<uint64_t>& bits, size_t end) {
+    size_t count = 0;
+    for (size_t w = 0; w < bits.size() && w * 64 < end; ++w) {
+        uint64_t word = bits[w];
+        if (end < (w + 1) * 64) {
+            word &= (uint64_t(1) << (end % 64)) - 1;
+        }
+        count += __builtin_popcountll(word);
+    }
+    return count;
+}
+
+size_t nthBit(const std::vector<uint64_t>& bits, size_t n) {
+    for (size_t w = 0; w < bits.size(); ++w) {
+        size_t count = __builtin_popcountll(bits[w]);
+        if (n > count) {
+            n -= count;
+            continue;
+        }
+        uint64_t word = bits[w];
+        while (--n > 0) {
+            word &= word - 1;
+        }
+        return w * 64 + __builtin_ctzll(word);
+    }
+    assert(false);
+    return 0;
+}
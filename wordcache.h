@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "buffer.h"
+
+// Where words start and end in buffer lines, one bit per byte, for word
+// motions to count with popcounts and find with bit scans instead of
+// classifying a character at a time. Built by the SIMD classifier the first
+// time a line is asked for and dropped per line on edit, like RenderCache.
+class WordCache {
+public:
+    struct Bits {
+        std::vector<uint64_t> starts;
+        std::vector<uint64_t> ends;
+        size_t length;
+    };
+
+    WordCache();
+
+    // Boundaries in `line`, built from `buffer` if not cached. Valid until
+    // the next call
+    const Bits& get(const Buffer& buffer, size_t line);
+
+    void invalidate(size_t line);
+
+    // Drop `line` and everything after it, for when lines shift
+    void invalidateFrom(size_t line);
+
+private:
+    static constexpr size_t ENTRIES = 256;
+
+    struct Entry {
+        bool valid;
+        size_t line;
+        Bits bits;
+    };
+
+    std::vector<Entry> entries;
+    std::string text;
+};
+
+// Set bits in `bits`, or in the first `end` bits of it
+size_t countBits(const std::vector<uint64_t>& bits);
+size_t countBits(const std::vector<uint64_t>& bits, size_t end);
+
+// Position of the `n`th set bit from the front, counting from 1. There must be
+// at least `n`
+size_t nthBit(const std::vector<uint64_t>& bits, size_t n);